@@ -27,10 +27,15 @@ struct Autobreak : Module
 
   StereoSmoothSubModule loop_smooth;
 
+  // When true, jumps land on the onset closest to the start of the slice
+  // rather than on the slice itself
+  bool snap_to_onsets = false;
+
   std::string root_dir;
   std::string path;
 
   Sample samples[NUMBER_OF_SAMPLES];
+  SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
   std::string loaded_filenames[NUMBER_OF_SAMPLES] = {""};
 
   dsp::SchmittTrigger resetTrigger;
@@ -86,12 +91,20 @@ struct Autobreak : Module
       json_object_set_new(json_root, ("loaded_sample_path_" + std::to_string(i+1)).c_str(), json_string(samples[i].path.c_str()));
     }
 
+    json_object_set_new(json_root, "sample_encoding", json_integer(sample_encoding));
+    json_object_set_new(json_root, "snap_to_onsets", json_boolean(snap_to_onsets));
+
     return json_root;
   }
 
   // Autoload settings
   void dataFromJson(json_t *json_root) override
   {
+    set_sample_encoding(sample_encoding_from_json(json_root), false);
+
+    json_t *snap_to_onsets_json = json_object_get(json_root, "snap_to_onsets");
+    if(snap_to_onsets_json) snap_to_onsets = json_is_true(snap_to_onsets_json);
+
     //
     // Load samples
     //
@@ -107,6 +120,19 @@ struct Autobreak : Module
     }
   }
 
+  // Change how this module's samples are stored in memory.  Samples that are
+  // already loaded get reloaded unless 'reload' is false.
+  void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+  {
+    this->sample_encoding = encoding;
+
+    for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++)
+    {
+      samples[i].encoding = encoding;
+      if(reload && (samples[i].path != "")) samples[i].load(samples[i].path);
+    }
+  }
+
   float calculate_inputs(int input_index, int knob_index, int attenuator_index, float scale)
   {
     float input_value = inputs[input_index].getVoltage() / 10.0;
@@ -116,8 +142,26 @@ struct Autobreak : Module
     return(((input_value * scale) * attenuator_value) + (knob_value * scale));
   }
 
+  // Moves a jump to 'theoretical_position' onto the nearest onset, if
+  // 'to_onset' is true, and then onto the nearest zero crossing in the
+  // sample, and returns the theoretical position that ends up there.  Jumps
+  // from one crossing to another don't need smoothing.
+  float snap_jump(Sample *sample, float theoretical_position, float samples_to_play_per_loop, bool to_onset)
+  {
+    unsigned int position = (theoretical_position / samples_to_play_per_loop) * sample->size();
+    if(to_onset) position = sample->nearest_onset(position);
+    position = sample->nearest_zero_crossing(position);
+
+    // Aim for the middle of the frame so that rounding on the way back
+    // doesn't land on the frame before it
+    return(((position + 0.5f) / sample->size()) * samples_to_play_per_loop);
+  }
+
   void process(const ProcessArgs &args) override
   {
+    // Pick up any samples that have finished loading in the background
+    for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) samples[i].poll();
+
     unsigned int wav_input_value = calculate_inputs(WAV_INPUT, WAV_KNOB, WAV_ATTN_KNOB, NUMBER_OF_SAMPLES);
     wav_input_value = clamp(wav_input_value, 0, NUMBER_OF_SAMPLES - 1);
 
@@ -181,9 +225,12 @@ struct Autobreak : Module
 
       std::tie(left_output, right_output) = selected_sample->read((int)actual_playback_position);
 
-      // Handle smoothing
+      // Handle smoothing.  This happens before the gain, since it's the
+      // unscaled audio that the smoothing compares jumps against.
       float smooth_rate = (128.0f / args.sampleRate);
-      std::tie(left_output, right_output) = loop_smooth.process(left_output * GAIN, right_output * GAIN, smooth_rate);
+      std::tie(left_output, right_output) = loop_smooth.process(left_output, right_output, smooth_rate);
+      left_output *= GAIN;
+      right_output *= GAIN;
 
       // Output audio
       outputs[AUDIO_OUTPUT_LEFT].setVoltage(left_output);
@@ -201,7 +248,8 @@ struct Autobreak : Module
 
         if(breakbeat_location != -1)
         {
-          theoretical_playback_position = breakbeat_location * (samples_to_play_per_loop / 16.0f);
+          theoretical_playback_position = snap_jump(selected_sample, breakbeat_location * (samples_to_play_per_loop / 16.0f), samples_to_play_per_loop, snap_to_onsets);
+          loop_smooth.trigger();
         }
 
         clock_triggered = false;
@@ -210,7 +258,7 @@ struct Autobreak : Module
       // Loop the theoretical_playback_position
       if(theoretical_playback_position >= samples_to_play_per_loop)
       {
-        theoretical_playback_position = 0;
+        theoretical_playback_position = snap_jump(selected_sample, 0, samples_to_play_per_loop, false);
         loop_smooth.trigger();
       }
 
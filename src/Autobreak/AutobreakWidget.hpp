@@ -55,5 +55,26 @@ struct AutobreakWidget : ModuleWidget
 			menu_item_load_sample->module = module;
 			menu->addChild(menu_item_load_sample);
 		}
+
+		//
+		// Options
+		// =====================================================================
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Options"));
+
+		struct SnapToOnsetsMenuItem : MenuItem {
+			Autobreak* module;
+			void onAction(const event::Action& e) override {
+				module->snap_to_onsets = !(module->snap_to_onsets);
+			}
+		};
+
+		SnapToOnsetsMenuItem* snap_to_onsets_menu_item = createMenuItem<SnapToOnsetsMenuItem>("Snap jumps to onsets");
+		snap_to_onsets_menu_item->rightText = CHECKMARK(module->snap_to_onsets);
+		snap_to_onsets_menu_item->module = module;
+		menu->addChild(snap_to_onsets_menu_item);
+
+		append_sample_encoding_menu(menu, module);
 	}
 };
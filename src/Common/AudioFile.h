@@ -31,6 +31,10 @@
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "mapped_file.hpp"
+#include "pcm_conversion.hpp"
 
 //=============================================================
 /** The different types of audio file, plus some other types to
@@ -94,6 +98,9 @@ public:
     /** Prints a summary of the audio file to the console */
     void printSummary() const;
 
+    /** @Returns how fast the last call to load() read the file, in megabytes per second.  tools/sample_benchmark reports it. */
+    double getLoadThroughput() const;
+
     //=============================================================
 
     /** Set the audio buffer for this AudioFile by copying samples from another buffer.
@@ -142,9 +149,9 @@ private:
     };
 
     //=============================================================
-    AudioFileFormat determineAudioFileFormat (std::vector<uint8_t>& fileData);
-    bool decodeWaveFile (std::vector<uint8_t>& fileData);
-    bool decodeAiffFile (std::vector<uint8_t>& fileData);
+    AudioFileFormat determineAudioFileFormat (const uint8_t* fileData, size_t fileSize);
+    bool decodeWaveFile (const uint8_t* fileData, size_t fileSize);
+    bool decodeAiffFile (const uint8_t* fileData, size_t fileSize);
 
     //=============================================================
     bool saveToWaveFile (std::string filePath);
@@ -154,22 +161,14 @@ private:
     void clearAudioBuffer();
 
     //=============================================================
-    int32_t fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness = Endianness::LittleEndian);
-    int16_t twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness = Endianness::LittleEndian);
-    int getIndexOfString (std::vector<uint8_t>& source, std::string s);
-
-    //=============================================================
-    T sixteenBitIntToSample (int16_t sample);
-    int16_t sampleToSixteenBitInt (T sample);
+    int32_t fourBytesToInt (const uint8_t* source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
+    int16_t twoBytesToInt (const uint8_t* source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
+    int64_t findChunk (const uint8_t* fileData, size_t fileSize, const char* chunkID, Endianness endianness = Endianness::LittleEndian);
 
     //=============================================================
-    uint8_t sampleToSingleByte (T sample);
-    T singleByteToSample (uint8_t sample);
-
-    uint32_t getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex);
-    bool tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2);
+    uint32_t getAiffSampleRate (const uint8_t* fileData, size_t sampleRateStartIndex);
+    bool tenByteMatch (const uint8_t* v1, size_t startIndex1, std::vector<uint8_t>& v2, int startIndex2);
     void addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint32_t sampleRate);
-    T clamp (T v1, T minValue, T maxValue);
 
     //=============================================================
     void addStringToFileData (std::vector<uint8_t>& fileData, std::string s);
@@ -178,6 +177,7 @@ private:
 
     //=============================================================
     bool writeDataToFile (std::vector<uint8_t>& fileData, std::string filePath);
+    bool encodeAudioData (std::vector<uint8_t>& fileData, PcmFormat pcmFormat, bool bigEndian);
 
     //=============================================================
     void reportError (std::string errorMessage);
@@ -187,6 +187,7 @@ private:
     uint32_t sampleRate;
     int bitDepth;
     bool logErrorsToConsole {true};
+    double loadThroughput {0.};
 };
 
 
@@ -312,6 +313,14 @@ void AudioFile<T>::printSummary() const
     std::cout << "|======================================|" << std::endl;
 }
 
+//=============================================================
+template <class T>
+double AudioFile<T>::getLoadThroughput() const
+{
+    return loadThroughput;
+}
+
+
 //=============================================================
 template <class T>
 bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
@@ -414,55 +423,68 @@ void AudioFile<T>::shouldLogErrorsToConsole (bool logErrors)
 template <class T>
 bool AudioFile<T>::load (std::string filePath)
 {
-    std::ifstream file (filePath, std::ios::binary);
+    auto startTime = std::chrono::steady_clock::now();
+
+    // The file is memory-mapped rather than copied into a vector.  The decoders
+    // below parse the chunks in place and convert the audio straight from the
+    // mapped pages.
+    MappedFile file;
 
     // check the file exists
-    if (! file.good())
+    if (! file.open (filePath))
     {
         reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
         return false;
     }
 
-    file.unsetf (std::ios::skipws);
-    std::istream_iterator<uint8_t> begin (file), end;
-    std::vector<uint8_t> fileData (begin, end);
+    if (file.size < 12)
+    {
+        reportError ("ERROR: this file is too small to be an audio file\n" + filePath);
+        return false;
+    }
+
+    bool loaded = false;
 
     // get audio file format
-    audioFileFormat = determineAudioFileFormat (fileData);
+    audioFileFormat = determineAudioFileFormat (file.data, file.size);
 
     if (audioFileFormat == AudioFileFormat::Wave)
     {
-        return decodeWaveFile (fileData);
+        loaded = decodeWaveFile (file.data, file.size);
     }
     else if (audioFileFormat == AudioFileFormat::Aiff)
     {
-        return decodeAiffFile (fileData);
+        loaded = decodeAiffFile (file.data, file.size);
     }
     else
     {
         reportError ("Audio File Type: Error");
-        return false;
     }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    loadThroughput = (elapsed.count() > 0.) ? ((double) file.size / 1000000.) / elapsed.count() : 0.;
+
+    return loaded;
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
+bool AudioFile<T>::decodeWaveFile (const uint8_t* fileData, size_t fileSize)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID (fileData.begin(), fileData.begin() + 4);
+    std::string headerChunkID (fileData, fileData + 4);
     //int32_t fileSizeInBytes = fourBytesToInt (fileData, 4) + 8;
-    std::string format (fileData.begin() + 8, fileData.begin() + 12);
+    std::string format (fileData + 8, fileData + 12);
 
     // -----------------------------------------------------------
     // try and find the start points of key chunks
-    int indexOfDataChunk = getIndexOfString (fileData, "data");
-    int indexOfFormatChunk = getIndexOfString (fileData, "fmt");
+    int64_t indexOfDataChunk = findChunk (fileData, fileSize, "data");
+    int64_t indexOfFormatChunk = findChunk (fileData, fileSize, "fmt ");
 
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE")
+    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE" || (size_t) indexOfFormatChunk + 24 > fileSize)
     {
         reportError ("ERROR: this doesn't seem to be a valid .WAV file");
         return false;
@@ -470,8 +492,7 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
 
     // -----------------------------------------------------------
     // FORMAT CHUNK
-    int f = indexOfFormatChunk;
-    std::string formatChunkID (fileData.begin() + f, fileData.begin() + f + 4);
+    size_t f = (size_t) indexOfFormatChunk;
     //int32_t formatChunkSize = fourBytesToInt (fileData, f + 4);
     uint16_t audioFormat = twoBytesToInt (fileData, f + 8);
     uint16_t numChannels = twoBytesToInt (fileData, f + 10);
@@ -512,86 +533,57 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
 
     // -----------------------------------------------------------
     // DATA CHUNK
-    int d = indexOfDataChunk;
-    std::string dataChunkID (fileData.begin() + d, fileData.begin() + d + 4);
-    int32_t dataChunkSize = fourBytesToInt (fileData, d + 4);
+    size_t d = (size_t) indexOfDataChunk;
+    size_t samplesStartIndex = d + 8;
+    size_t dataChunkSize = (uint32_t) fourBytesToInt (fileData, d + 4);
 
-    int numSamples = dataChunkSize / (numChannels * bitDepth / 8);
-    int samplesStartIndex = indexOfDataChunk + 8;
+    // Don't trust the chunk size past the end of the file.  Files that were
+    // being written when a recording was interrupted often get this wrong.
+    dataChunkSize = std::min (dataChunkSize, fileSize - samplesStartIndex);
+
+    int numSamples = (int) (dataChunkSize / numBytesPerBlock);
 
     clearAudioBuffer();
     samples.resize (numChannels);
 
-    for (int i = 0; i < numSamples; i++)
+    std::vector<T*> channels (numChannels);
+
+    for (int channel = 0; channel < numChannels; channel++)
     {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerBlock * i) + channel * numBytesPerSample;
-
-            if (bitDepth == 8)
-            {
-                T sample = singleByteToSample (fileData[sampleIndex]);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex + 2] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex];
-
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt (fileData, sampleIndex);
-                T sample;
-
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sample = (T)reinterpret_cast<float&> (sampleAsInt);
-                else // assume PCM
-                    sample = (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
-
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
+        samples[channel].resize (numSamples);
+        channels[channel] = samples[channel].data();
     }
 
+    // convert the whole data chunk in one pass, rather than a sample at a time
+    PcmFormat pcmFormat = bitDepth == 8 ? PCM_UNSIGNED_8 : bitDepth == 16 ? PCM_INT16 : bitDepth == 24 ? PCM_INT24
+                        : audioFormat == WavAudioFormat::IEEEFloat ? PCM_FLOAT32 : PCM_INT32;
+
+    decode_pcm (fileData + samplesStartIndex, pcmFormat, false, numChannels, (size_t) numSamples, channels.data());
+
     return true;
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
+bool AudioFile<T>::decodeAiffFile (const uint8_t* fileData, size_t fileSize)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID (fileData.begin(), fileData.begin() + 4);
+    std::string headerChunkID (fileData, fileData + 4);
     //int32_t fileSizeInBytes = fourBytesToInt (fileData, 4, Endianness::BigEndian) + 8;
-    std::string format (fileData.begin() + 8, fileData.begin() + 12);
+    std::string format (fileData + 8, fileData + 12);
 
     int audioFormat = format == "AIFF" ? AIFFAudioFormat::Uncompressed : format == "AIFC" ? AIFFAudioFormat::Compressed : AIFFAudioFormat::Error;
 
     // -----------------------------------------------------------
     // try and find the start points of key chunks
-    int indexOfCommChunk = getIndexOfString (fileData, "COMM");
-    int indexOfSoundDataChunk = getIndexOfString (fileData, "SSND");
+    int64_t indexOfCommChunk = findChunk (fileData, fileSize, "COMM", Endianness::BigEndian);
+    int64_t indexOfSoundDataChunk = findChunk (fileData, fileSize, "SSND", Endianness::BigEndian);
 
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfSoundDataChunk == -1 || indexOfCommChunk == -1 || headerChunkID != "FORM" || audioFormat == AIFFAudioFormat::Error)
+    if (indexOfSoundDataChunk == -1 || indexOfCommChunk == -1 || headerChunkID != "FORM" || audioFormat == AIFFAudioFormat::Error
+        || (size_t) indexOfCommChunk + 26 > fileSize || (size_t) indexOfSoundDataChunk + 16 > fileSize)
     {
         reportError ("ERROR: this doesn't seem to be a valid AIFF file");
         return false;
@@ -599,8 +591,7 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
 
     // -----------------------------------------------------------
     // COMM CHUNK
-    int p = indexOfCommChunk;
-    std::string commChunkID (fileData.begin() + p, fileData.begin() + p + 4);
+    size_t p = (size_t) indexOfCommChunk;
     //int32_t commChunkSize = fourBytesToInt (fileData, p + 4, Endianness::BigEndian);
     int16_t numChannels = twoBytesToInt (fileData, p + 8, Endianness::BigEndian);
     int32_t numSamplesPerChannel = fourBytesToInt (fileData, p + 10, Endianness::BigEndian);
@@ -630,19 +621,18 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
 
     // -----------------------------------------------------------
     // SSND CHUNK
-    int s = indexOfSoundDataChunk;
-    std::string soundDataChunkID (fileData.begin() + s, fileData.begin() + s + 4);
+    size_t s = (size_t) indexOfSoundDataChunk;
     int32_t soundDataChunkSize = fourBytesToInt (fileData, s + 4, Endianness::BigEndian);
     int32_t offset = fourBytesToInt (fileData, s + 8, Endianness::BigEndian);
     //int32_t blockSize = fourBytesToInt (fileData, s + 12, Endianness::BigEndian);
 
     int numBytesPerSample = bitDepth / 8;
     int numBytesPerFrame = numBytesPerSample * numChannels;
-    int totalNumAudioSampleBytes = numSamplesPerChannel * numBytesPerFrame;
-    int samplesStartIndex = s + 16 + (int)offset;
+    int64_t totalNumAudioSampleBytes = (int64_t) numSamplesPerChannel * numBytesPerFrame;
+    size_t samplesStartIndex = s + 16 + (size_t) offset;
 
     // sanity check the data
-    if ((soundDataChunkSize - 8) != totalNumAudioSampleBytes || totalNumAudioSampleBytes > static_cast<long>(fileData.size() - samplesStartIndex))
+    if ((soundDataChunkSize - 8) != totalNumAudioSampleBytes || samplesStartIndex > fileSize || totalNumAudioSampleBytes > static_cast<int64_t>(fileSize - samplesStartIndex))
     {
         reportError ("ERROR: the metadatafor this file doesn't seem right");
         return false;
@@ -651,60 +641,25 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
     clearAudioBuffer();
     samples.resize (numChannels);
 
-    for (int i = 0; i < numSamplesPerChannel; i++)
+    std::vector<T*> channels (numChannels);
+
+    for (int channel = 0; channel < numChannels; channel++)
     {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerFrame * i) + channel * numBytesPerSample;
-
-            if (bitDepth == 8)
-            {
-                int8_t sampleAsSigned8Bit = (int8_t)fileData[sampleIndex];
-                T sample = (T)sampleAsSigned8Bit / (T)128.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex + 2];
-
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
-                T sample;
-
-                if (audioFormat == AIFFAudioFormat::Compressed)
-                    sample = (T)reinterpret_cast<float&> (sampleAsInt);
-                else // assume uncompressed
-                    sample = (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
-
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
+        samples[channel].resize (numSamplesPerChannel);
+        channels[channel] = samples[channel].data();
     }
 
+    PcmFormat pcmFormat = bitDepth == 8 ? PCM_SIGNED_8 : bitDepth == 16 ? PCM_INT16 : bitDepth == 24 ? PCM_INT24
+                        : audioFormat == AIFFAudioFormat::Compressed ? PCM_FLOAT32 : PCM_INT32;
+
+    decode_pcm (fileData + samplesStartIndex, pcmFormat, true, numChannels, (size_t) numSamplesPerChannel, channels.data());
+
     return true;
 }
 
 //=============================================================
 template <class T>
-uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex)
+uint32_t AudioFile<T>::getAiffSampleRate (const uint8_t* fileData, size_t sampleRateStartIndex)
 {
     for (auto it : aiffSampleRateTable)
     {
@@ -717,7 +672,7 @@ uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sa
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2)
+bool AudioFile<T>::tenByteMatch (const uint8_t* v1, size_t startIndex1, std::vector<uint8_t>& v2, int startIndex2)
 {
     for (int i = 0; i < 10; i++)
     {
@@ -800,51 +755,10 @@ bool AudioFile<T>::saveToWaveFile (std::string filePath)
     addStringToFileData (fileData, "data");
     addInt32ToFileData (fileData, dataChunkSize);
 
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
-    {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
-                addInt16ToFileData (fileData, sampleAsInt);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-
-                uint8_t bytes[3];
-                bytes[2] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[0] = (uint8_t) sampleAsIntAgain & 0xFF;
-
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt;
-
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sampleAsInt = (int32_t) reinterpret_cast<int32_t&> (samples[channel][i]);
-                else // assume PCM
-                    sampleAsInt = (int32_t) (samples[channel][i] * std::numeric_limits<int32_t>::max());
-
-                addInt32ToFileData (fileData, sampleAsInt, Endianness::LittleEndian);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
-    }
+    PcmFormat pcmFormat = bitDepth == 8 ? PCM_UNSIGNED_8 : bitDepth == 16 ? PCM_INT16 : bitDepth == 24 ? PCM_INT24 : PCM_FLOAT32;
+
+    if (! encodeAudioData (fileData, pcmFormat, false))
+        return false;
 
     // check that the various sizes we put in the metadata are correct
     if (fileSizeInBytes != static_cast<int32_t> (fileData.size() - 8) || dataChunkSize != (getNumSamplesPerChannel() * getNumChannels() * (bitDepth / 8)))
@@ -895,46 +809,11 @@ bool AudioFile<T>::saveToAiffFile (std::string filePath)
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // offset
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // block size
 
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
-    {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
-                addInt16ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-
-                uint8_t bytes[3];
-                bytes[0] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[2] = (uint8_t) sampleAsIntAgain & 0xFF;
-
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else if (bitDepth == 32)
-            {
-                // write samples as signed integers (no implementation yet for floating point, but looking at WAV implementation should help)
-                int32_t sampleAsInt = (int32_t) (samples[channel][i] * std::numeric_limits<int32_t>::max());
-                addInt32ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
-    }
+    // write 32-bit samples as signed integers (no implementation yet for floating point, but looking at WAV implementation should help)
+    PcmFormat pcmFormat = bitDepth == 8 ? PCM_SIGNED_8 : bitDepth == 16 ? PCM_INT16 : bitDepth == 24 ? PCM_INT24 : PCM_INT32;
+
+    if (! encodeAudioData (fileData, pcmFormat, true))
+        return false;
 
     // check that the various sizes we put in the metadata are correct
     if (fileSizeInBytes != static_cast<int32_t> (fileData.size() - 8) || soundDataChunkSize != getNumSamplesPerChannel() *  numBytesPerFrame + 8)
@@ -955,20 +834,40 @@ bool AudioFile<T>::writeDataToFile (std::vector<uint8_t>& fileData, std::string
 
     if (outputFile.is_open())
     {
-        for (size_t i = 0; i < fileData.size(); i++)
-        {
-            char value = (char) fileData[i];
-            outputFile.write (&value, sizeof (char));
-        }
-
+        outputFile.write (reinterpret_cast<const char*> (fileData.data()), (std::streamsize) fileData.size());
         outputFile.close();
 
-        return true;
+        return ! outputFile.fail();
     }
 
     return false;
 }
 
+//=============================================================
+template <class T>
+bool AudioFile<T>::encodeAudioData (std::vector<uint8_t>& fileData, PcmFormat pcmFormat, bool bigEndian)
+{
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24 && bitDepth != 32)
+    {
+        assert (false && "Trying to write a file with unsupported bit depth");
+        return false;
+    }
+
+    std::vector<const T*> channels (getNumChannels());
+
+    for (int channel = 0; channel < getNumChannels(); channel++)
+        channels[channel] = samples[channel].data();
+
+    // size the buffer once and convert straight into it
+    size_t dataStartIndex = fileData.size();
+    size_t numFrames = (size_t) getNumSamplesPerChannel();
+    fileData.resize (dataStartIndex + numFrames * getNumChannels() * (bitDepth / 8));
+
+    encode_pcm (channels.data(), getNumChannels(), numFrames, pcmFormat, bigEndian, fileData.data() + dataStartIndex);
+
+    return true;
+}
+
 //=============================================================
 template <class T>
 void AudioFile<T>::addStringToFileData (std::vector<uint8_t>& fileData, std::string s)
@@ -1037,9 +936,12 @@ void AudioFile<T>::clearAudioBuffer()
 
 //=============================================================
 template <class T>
-AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fileData)
+AudioFileFormat AudioFile<T>::determineAudioFileFormat (const uint8_t* fileData, size_t fileSize)
 {
-    std::string header (fileData.begin(), fileData.begin() + 4);
+    if (fileSize < 4)
+        return AudioFileFormat::Error;
+
+    std::string header (fileData, fileData + 4);
 
     if (header == "RIFF")
         return AudioFileFormat::Wave;
@@ -1051,21 +953,21 @@ AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fi
 
 //=============================================================
 template <class T>
-int32_t AudioFile<T>::fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+int32_t AudioFile<T>::fourBytesToInt (const uint8_t* source, size_t startIndex, Endianness endianness)
 {
-    int32_t result;
+    uint32_t result;
 
     if (endianness == Endianness::LittleEndian)
-        result = (source[startIndex + 3] << 24) | (source[startIndex + 2] << 16) | (source[startIndex + 1] << 8) | source[startIndex];
+        result = ((uint32_t) source[startIndex + 3] << 24) | ((uint32_t) source[startIndex + 2] << 16) | ((uint32_t) source[startIndex + 1] << 8) | source[startIndex];
     else
-        result = (source[startIndex] << 24) | (source[startIndex + 1] << 16) | (source[startIndex + 2] << 8) | source[startIndex + 3];
+        result = ((uint32_t) source[startIndex] << 24) | ((uint32_t) source[startIndex + 1] << 16) | ((uint32_t) source[startIndex + 2] << 8) | source[startIndex + 3];
 
-    return result;
+    return (int32_t) result;
 }
 
 //=============================================================
 template <class T>
-int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+int16_t AudioFile<T>::twoBytesToInt (const uint8_t* source, size_t startIndex, Endianness endianness)
 {
     int16_t result;
 
@@ -1079,63 +981,23 @@ int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startInde
 
 //=============================================================
 template <class T>
-int AudioFile<T>::getIndexOfString (std::vector<uint8_t>& source, std::string stringToSearchFor)
+int64_t AudioFile<T>::findChunk (const uint8_t* fileData, size_t fileSize, const char* chunkID, Endianness endianness)
 {
-    int index = -1;
-    int stringLength = (int)stringToSearchFor.length();
+    // Walk the list of chunks that follows the 12 byte RIFF or FORM header,
+    // hopping from one chunk header to the next instead of scanning every byte
+    size_t offset = 12;
 
-    for (size_t i = 0; i < source.size() - stringLength;i++)
+    while (offset + 8 <= fileSize)
     {
-        std::string section (source.begin() + i, source.begin() + i + stringLength);
+        if (std::memcmp (fileData + offset, chunkID, 4) == 0)
+            return (int64_t) offset;
 
-        if (section == stringToSearchFor)
-        {
-            index = static_cast<int> (i);
-            break;
-        }
+        // chunks are padded to an even number of bytes
+        size_t chunkSize = (uint32_t) fourBytesToInt (fileData, offset + 4, endianness);
+        offset += 8 + chunkSize + (chunkSize & 1);
     }
 
-    return index;
-}
-
-//=============================================================
-template <class T>
-T AudioFile<T>::sixteenBitIntToSample (int16_t sample)
-{
-    return static_cast<T> (sample) / static_cast<T> (32768.);
-}
-
-//=============================================================
-template <class T>
-int16_t AudioFile<T>::sampleToSixteenBitInt (T sample)
-{
-    sample = clamp (sample, -1., 1.);
-    return static_cast<int16_t> (sample * 32767.);
-}
-
-//=============================================================
-template <class T>
-uint8_t AudioFile<T>::sampleToSingleByte (T sample)
-{
-    sample = clamp (sample, -1., 1.);
-    sample = (sample + 1.) / 2.;
-    return static_cast<uint8_t> (sample * 255.);
-}
-
-//=============================================================
-template <class T>
-T AudioFile<T>::singleByteToSample (uint8_t sample)
-{
-    return static_cast<T> (sample - 128) / static_cast<T> (128.);
-}
-
-//=============================================================
-template <class T>
-T AudioFile<T>::clamp (T value, T minValue, T maxValue)
-{
-    value = std::min (value, maxValue);
-    value = std::max (value, minValue);
-    return value;
+    return -1;
 }
 
 //=============================================================
@@ -1,9 +1,25 @@
 #pragma once
 
+#include "recording_arena.hpp"
+#include "file_system.hpp"
+
 struct GrainEngineExpanderMessage
 {
   unsigned int sample_slot = 0;
   bool message_received = true;
-  std::string path = "";
-  std::string filename = "";
+
+  // The file to load, or where a take has been saved.  It's a FixedPath so
+  // that neither module allocates on the audio thread to pass it along.
+  FixedPath path;
+
+  // The recorded audio itself.  Grain Engine MK2 plays it straight away,
+  // while the expander saves it in the background.  Grain Engine MK2 clears
+  // the take once it's playing, so that the message never holds the last
+  // reference to a take on the audio thread.
+  RecordedTake take;
+
+  // Which take this is, when it's being saved, or zero.  A message with a
+  // take number and no take says that the take has been saved to 'path'.
+  // One with neither is a file to load.
+  unsigned int take_number = 0;
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+#if defined(_WIN32)
+  #include <malloc.h>
+#endif
+
+//
+// Cache-line aligned allocation for the sample buffers.  C++11 doesn't give us
+// an aligned malloc, so these wrap whatever the platform provides.  Memory
+// from aligned_malloc() has to be released with aligned_free().
+//
+
+#define CACHE_LINE_SIZE 64
+
+inline void *aligned_malloc(size_t size, size_t alignment = CACHE_LINE_SIZE)
+{
+  if(size == 0) size = alignment;
+
+#if defined(_WIN32)
+  return(_aligned_malloc(size, alignment));
+#else
+  void *memory = nullptr;
+  if(posix_memalign(&memory, alignment, size) != 0) return(nullptr);
+  return(memory);
+#endif
+}
+
+inline void aligned_free(void *memory)
+{
+  if(memory == nullptr) return;
+
+#if defined(_WIN32)
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
+}
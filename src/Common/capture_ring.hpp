@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "recording_arena.hpp"
+#include "sample_loader.hpp"
+
+//
+// CaptureRingControl is shared between a CaptureRing, on the audio thread,
+// and its housekeeping task.  Housekeeping keeps a fully allocated spare ring
+// of the right size ready, and releases rings that the audio thread is done
+// with.  It works the same way as RecordingArenaControl.
+//
+
+struct CaptureRingControl
+{
+  std::atomic<RecordingChunksHandle *> spare;
+  std::atomic<RecordingChunksHandle *> retired;
+
+  // The ring's length in frames, which is always a power of two and a whole
+  // number of chunks, and how much of it a commit takes
+  std::atomic<unsigned int> ring_frames;
+  std::atomic<unsigned int> capture_frames;
+  std::atomic<unsigned int> sample_rate;
+
+  // The ring, once the CaptureRing is gone
+  RecordingChunksHandle orphaned;
+
+  std::atomic<bool> closed;
+
+  CaptureRingControl() : spare(nullptr), retired(nullptr), ring_frames(0), capture_frames(0), sample_rate(0), closed(false)
+  {
+  }
+
+  ~CaptureRingControl()
+  {
+    delete spare.load();
+    delete retired.load();
+  }
+
+  static unsigned int chunks_in(unsigned int frames)
+  {
+    return(frames / RECORDING_ARENA_CHUNK_FRAMES);
+  }
+
+  // Housekeeping thread.  Returns true once the ring is gone.
+  bool maintain()
+  {
+    if(closed) return(true);
+
+    delete retired.exchange(nullptr, std::memory_order_acq_rel);
+
+    // A spare that's the wrong size, because the length was changed, is
+    // swapped for one that's right.  The audio thread only ever takes the
+    // spare, so it's safe to take it back here for a moment.  Only this
+    // thread ever puts a spare in place, so it's installed with a
+    // compare-and-swap just in case, and let go of if the slot was filled.
+    unsigned int wanted = chunks_in(ring_frames);
+    RecordingChunksHandle *handle = spare.exchange(nullptr, std::memory_order_acq_rel);
+
+    if((handle == nullptr) || ((*handle)->committed != wanted))
+    {
+      delete handle;
+      handle = new RecordingChunksHandle(std::make_shared<RecordingChunks>());
+      (*handle)->commit(wanted);
+    }
+
+    RecordingChunksHandle *empty = nullptr;
+    if(! spare.compare_exchange_strong(empty, handle, std::memory_order_acq_rel)) delete handle;
+
+    return(false);
+  }
+};
+
+//
+// CaptureRing records continuously into a ring of preallocated chunks, so
+// that the last few seconds of audio can be kept after the fact.  commit()
+// hands the most recent stretch of the ring out as a RecordedTake without
+// copying anything.  A fresh ring that housekeeping set aside ahead of time
+// takes the old one's place, so committing costs the same no matter how long
+// the ring is.
+//
+// The ring is rounded up to a power of two frames, which lets a single AND
+// find any frame in it.  Until its replacement is ready, and while the first
+// ring is being allocated, frames are dropped.
+//
+// configure() has to be called, off of the audio thread, before recording.
+//
+
+struct CaptureRing
+{
+  std::shared_ptr<CaptureRingControl> control;
+  std::shared_ptr<SampleLoader> loader;
+  RecordingChunksHandle ring;
+
+  // The length of 'ring', which lags behind the control's when the length
+  // is changed, until the new spare is swapped in
+  unsigned int ring_frames = 0;
+
+  // Total frames written into 'ring', and how many of its frames hold audio
+  unsigned int write_position = 0;
+  unsigned int filled = 0;
+
+  CaptureRing()
+  {
+  }
+
+  ~CaptureRing()
+  {
+    if(control)
+    {
+      control->orphaned.swap(ring);
+      control->closed = true;
+    }
+  }
+
+  CaptureRing(const CaptureRing &) = delete;
+  CaptureRing &operator=(const CaptureRing &) = delete;
+
+  // Not on the audio thread.  Keep at least the last 'capture_frames'
+  // frames.  The first time this is called, it starts the housekeeping task
+  // that sets rings aside.
+  void configure(unsigned int capture_frames, unsigned int sample_rate)
+  {
+    unsigned int ring_frames = RECORDING_ARENA_CHUNK_FRAMES;
+    while((ring_frames < capture_frames) && (ring_frames <= (std::numeric_limits<unsigned int>::max() / 4))) ring_frames *= 2;
+
+    if(! control)
+    {
+      control = std::make_shared<CaptureRingControl>();
+      std::shared_ptr<CaptureRingControl> shared_control = control;
+      loader = get_sample_loader();
+      loader->housekeeping([shared_control]() { return shared_control->maintain(); });
+    }
+
+    control->capture_frames = std::min(capture_frames, ring_frames);
+    control->sample_rate = sample_rate;
+    control->ring_frames = ring_frames;
+  }
+
+  // Audio thread.  Adds a frame to the ring, overwriting the oldest one once
+  // it's full.
+  void push(float left, float right)
+  {
+    if(! control) return;
+    if((ring_frames != control->ring_frames.load(std::memory_order_relaxed)) && (! take_spare())) return;
+
+    float *frame = ring->frame(write_position & (ring_frames - 1));
+    frame[0] = left;
+    frame[1] = right;
+
+    write_position++;
+    filled = std::min(filled + 1, ring_frames);
+  }
+
+  // Audio thread.  Hands the last 'capture_frames' frames, or as many as
+  // there are, to 'take', and starts over with an empty ring.  'take' has to
+  // be empty.  Returns false, leaving 'take' alone, if there's nothing to
+  // hand out.
+  bool commit(RecordedTake &take)
+  {
+    if((! control) || (filled == 0) || (! ring)) return(false);
+
+    unsigned int count = std::min(filled, control->capture_frames.load(std::memory_order_relaxed));
+
+    take.audio = ring;
+    take.frame_count = count;
+    take.sample_rate = control->sample_rate;
+    take.start = write_position - count;
+    take.mask = ring_frames - 1;
+
+    // Nothing else writes into this ring, so it doesn't have to be released
+    // here.  If the spare isn't ready, frames are dropped until it is.
+    ring_frames = 0;
+    take_spare();
+
+    return(true);
+  }
+
+  // Audio thread.  Swaps in the spare ring if it's the right size, and leaves
+  // the old one for housekeeping to release.
+  bool take_spare()
+  {
+    if(control->retired.load(std::memory_order_acquire) != nullptr) return(false);
+
+    unsigned int wanted = control->ring_frames.load(std::memory_order_relaxed);
+    RecordingChunksHandle *spare = control->spare.exchange(nullptr, std::memory_order_acq_rel);
+    if(spare == nullptr) return(false);
+
+    // Housekeeping hasn't caught up with a change in length.  The spare is
+    // retired, and never put back, so housekeeping is the only one that ever
+    // fills the slot.  'retired' was checked to be empty above, and only this
+    // thread fills it.
+    if(((*spare)->committed.load(std::memory_order_acquire) * RECORDING_ARENA_CHUNK_FRAMES) != wanted)
+    {
+      control->retired.store(spare, std::memory_order_release);
+      return(false);
+    }
+
+    ring.swap(*spare);
+    ring_frames = wanted;
+    write_position = 0;
+    filled = 0;
+    control->retired.store(spare, std::memory_order_release);
+
+    return(true);
+  }
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+  #include <sys/utime.h>
+  #include <io.h>
+#else
+  #include <utime.h>
+  #include <unistd.h>
+#endif
+
+//
+// Small wrappers around the file operations that need special handling on
+// Windows, where Rack's UTF-8 paths have to be converted to wide strings
+// before they can be handed to the operating system.
+//
+
+#if defined(_WIN32)
+inline std::wstring widen_path(const std::string &path)
+{
+  int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+  if(length <= 0) return(std::wstring());
+  std::wstring wide_path(length, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide_path[0], length);
+  return(wide_path);
+}
+
+inline FILE *open_file(const std::string &path, const char *mode)
+{
+  return(_wfopen(widen_path(path).c_str(), widen_path(mode).c_str()));
+}
+
+// Renames 'from' to 'to', replacing 'to' if it's already there
+inline bool replace_file(const std::string &from, const std::string &to)
+{
+  return(MoveFileExW(widen_path(from).c_str(), widen_path(to).c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+}
+
+inline bool remove_file(const std::string &path)
+{
+  return(DeleteFileW(widen_path(path).c_str()) != 0);
+}
+
+// Sets the file's modification time to now
+inline void touch_file(const std::string &path)
+{
+  _wutime(widen_path(path).c_str(), NULL);
+}
+
+inline bool file_status(const std::string &path, int64_t &size, int64_t &modification_time)
+{
+  struct _stat64 status;
+  if(_wstat64(widen_path(path).c_str(), &status) != 0) return(false);
+  size = status.st_size;
+  modification_time = status.st_mtime;
+  return(true);
+}
+
+// Flushes the file all the way to the disk
+inline bool sync_file(FILE *file)
+{
+  return((std::fflush(file) == 0) && (_commit(_fileno(file)) == 0));
+}
+#else
+inline FILE *open_file(const std::string &path, const char *mode)
+{
+  return(std::fopen(path.c_str(), mode));
+}
+
+// Renames 'from' to 'to', replacing 'to' if it's already there
+inline bool replace_file(const std::string &from, const std::string &to)
+{
+  return(std::rename(from.c_str(), to.c_str()) == 0);
+}
+
+inline bool remove_file(const std::string &path)
+{
+  return(std::remove(path.c_str()) == 0);
+}
+
+// Sets the file's modification time to now
+inline void touch_file(const std::string &path)
+{
+  utime(path.c_str(), NULL);
+}
+
+inline bool file_status(const std::string &path, int64_t &size, int64_t &modification_time)
+{
+  struct stat status;
+  if(stat(path.c_str(), &status) != 0) return(false);
+  size = status.st_size;
+  modification_time = status.st_mtime;
+  return(true);
+}
+
+// Flushes the file all the way to the disk
+inline bool sync_file(FILE *file)
+{
+  return((std::fflush(file) == 0) && (fsync(fileno(file)) == 0));
+}
+#endif
+
+// Longest path, including the terminating zero, that a FixedPath can hold
+#define FIXED_PATH_LENGTH 4096
+
+//
+// A path that lives in a fixed amount of space, so that it can be handed
+// around and copied on the audio thread without allocating.  It's filled in
+// off of the audio thread.  A path that doesn't fit is refused, and leaves
+// the FixedPath empty, rather than being cut short and pointing somewhere
+// else.
+//
+struct FixedPath
+{
+  char text[FIXED_PATH_LENGTH];
+
+  FixedPath()
+  {
+    text[0] = '\0';
+  }
+
+  bool assign(const std::string &path)
+  {
+    if(path.size() >= FIXED_PATH_LENGTH)
+    {
+      text[0] = '\0';
+      return(false);
+    }
+
+    std::memcpy(text, path.c_str(), path.size() + 1);
+    return(true);
+  }
+
+  void clear()
+  {
+    text[0] = '\0';
+  }
+
+  bool empty() const
+  {
+    return(text[0] == '\0');
+  }
+
+  const char *c_str() const
+  {
+    return(text);
+  }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+//
+// MappedFile maps a whole file into memory, read-only.  Reading from 'data'
+// pages the file in on demand, so large files can be parsed in place without
+// first being copied into a buffer.  The mapping is released when the
+// MappedFile is closed or destroyed.
+//
+// Files are assumed to be read from start to finish.  Pass 'sequential' as
+// false for files that are going to be played from, where reads jump around.
+//
+
+struct MappedFile
+{
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+
+#if defined(_WIN32)
+  HANDLE file_handle = INVALID_HANDLE_VALUE;
+  HANDLE mapping_handle = NULL;
+#endif
+
+  MappedFile()
+  {
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path, bool sequential = true)
+  {
+    close();
+
+#if defined(_WIN32)
+    // Convert the UTF-8 path that Rack uses into the wide string that Windows wants
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+    if(length <= 0) return(false);
+    std::wstring wide_path(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide_path[0], length);
+
+    file_handle = CreateFileW(wide_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+    if(file_handle == INVALID_HANDLE_VALUE) return(false);
+
+    LARGE_INTEGER file_size;
+    if(! GetFileSizeEx(file_handle, &file_size) || (file_size.QuadPart == 0))
+    {
+      close();
+      return(false);
+    }
+
+    mapping_handle = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping_handle == NULL)
+    {
+      close();
+      return(false);
+    }
+
+    const void *view = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if(view == NULL)
+    {
+      close();
+      return(false);
+    }
+
+    data = (const uint8_t *) view;
+    size = (size_t) file_size.QuadPart;
+#else
+    int file_descriptor = ::open(path.c_str(), O_RDONLY);
+    if(file_descriptor < 0) return(false);
+
+    struct stat file_status;
+    if((fstat(file_descriptor, &file_status) != 0) || (file_status.st_size <= 0))
+    {
+      ::close(file_descriptor);
+      return(false);
+    }
+
+    void *view = mmap(NULL, (size_t) file_status.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+
+    // The mapping keeps its own reference to the file
+    ::close(file_descriptor);
+
+    if(view == MAP_FAILED) return(false);
+
+    madvise(view, (size_t) file_status.st_size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+
+    data = (const uint8_t *) view;
+    size = (size_t) file_status.st_size;
+#endif
+
+    return(true);
+  }
+
+  void close()
+  {
+#if defined(_WIN32)
+    if(data) UnmapViewOfFile(data);
+    if(mapping_handle != NULL) CloseHandle(mapping_handle);
+    if(file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+    mapping_handle = NULL;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if(data) munmap((void *) data, size);
+#endif
+
+    data = nullptr;
+    size = 0;
+  }
+
+  bool is_open()
+  {
+    return(data != nullptr);
+  }
+};
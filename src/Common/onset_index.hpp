@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "sample_audio_buffer.hpp"
+
+// Frames in each analysis window, which has to be a power of two, and frames
+// between the starts of neighbouring windows
+#define ONSET_INDEX_WINDOW_FRAMES 1024
+#define ONSET_INDEX_HOP_FRAMES 512
+
+// Windows on either side of a peak in the spectral flux that it has to beat
+// to count as an onset, and windows before it that make up the threshold
+#define ONSET_INDEX_PEAK_RADIUS 2
+#define ONSET_INDEX_AVERAGE_WINDOWS 12
+
+// A peak has to be this many times the average flux of the windows before
+// it, plus ONSET_INDEX_MINIMUM_FLUX, to count.  Lower finds more onsets.
+#define ONSET_INDEX_SENSITIVITY 1.5f
+
+// The least flux that can be an onset.  Flux is summed over every bin of the
+// spectrum, so this is small next to a hit, but above the wobble of a steady
+// tone.
+#define ONSET_INDEX_MINIMUM_FLUX 20.0f
+
+// Spectrum magnitudes below this count as silence.  A full scale sine wave
+// is 256 in the window's spectrum, so this is nearly 90 dB down.
+#define ONSET_INDEX_MAGNITUDE_FLOOR 0.01f
+
+// Onsets closer together than this, in milliseconds, are counted as one
+#define ONSET_INDEX_MINIMUM_GAP 30
+
+// Onsets are placed at the start of the stretch of this many frames where
+// the level jumps the most
+#define ONSET_INDEX_REFINE_FRAMES 32
+
+//
+// OnsetIndex is a sorted list of the frames where something new starts in a
+// sample, such as drum hits or notes, so that a module can jump to the hit
+// closest to where it was going to land instead of somewhere in the middle
+// of one.
+//
+// Onsets are found with spectral flux.  The sample is mixed to mono and cut
+// into overlapping windows, and each window's spectrum is compared to the
+// one before it.  Wherever the spectrum gains energy much faster than it
+// had been just before, there's an onset.  Each one is then moved to the
+// exact spot in the window where the level jumps.
+//
+// The index is built once, on the loader thread, after the sample has become
+// playable, and never changes after that.  nearest() is a binary search, so it can be called from the audio
+// thread every time a module is triggered.  At 4 bytes an onset, even a long
+// sample's index is only a few kilobytes.
+//
+// A silent sample gets an empty index, and nearest() hands back whatever
+// position it's given.
+//
+
+struct OnsetIndex
+{
+  std::vector<unsigned int> positions;
+
+  static std::shared_ptr<const OnsetIndex> build(const SampleAudioBuffer *buffer)
+  {
+    std::shared_ptr<OnsetIndex> index = std::make_shared<OnsetIndex>();
+    unsigned int frame_count = buffer->size();
+    if(frame_count < ONSET_INDEX_WINDOW_FRAMES) return(index);
+
+    std::vector<float> flux = spectral_flux(buffer);
+    std::vector<unsigned int> peaks = pick_peaks(flux);
+
+    unsigned int sample_rate = (buffer->sample_rate > 0) ? buffer->sample_rate : 44100;
+    unsigned int minimum_gap = (unsigned int) (((uint64_t) sample_rate * ONSET_INDEX_MINIMUM_GAP) / 1000);
+
+    std::vector<float> window(ONSET_INDEX_WINDOW_FRAMES * 2);
+    std::vector<float> scratch(ONSET_INDEX_WINDOW_FRAMES * 4);
+
+    for(unsigned int peak : peaks)
+    {
+      // The onset is somewhere in window 'peak', or just before it
+      unsigned int start = (peak > 0) ? ((peak - 1) * ONSET_INDEX_HOP_FRAMES) : 0;
+      unsigned int position = refine(buffer, start, ONSET_INDEX_WINDOW_FRAMES + ONSET_INDEX_HOP_FRAMES, window.data(), scratch.data());
+
+      if(index->positions.empty() || (position >= index->positions.back() + minimum_gap))
+      {
+        index->positions.push_back(position);
+      }
+    }
+
+    index->positions.shrink_to_fit();
+    return(index);
+  }
+
+  // The onset closest to 'position', or 'position' itself if there aren't any
+  unsigned int nearest(unsigned int position) const
+  {
+    if(positions.empty()) return(position);
+
+    std::vector<unsigned int>::const_iterator after = std::lower_bound(positions.begin(), positions.end(), position);
+
+    if(after == positions.begin()) return(*after);
+    if(after == positions.end()) return(positions.back());
+
+    unsigned int before = *(after - 1);
+    return(((position - before) <= (*after - position)) ? before : *after);
+  }
+
+  size_t size() const
+  {
+    return(positions.size());
+  }
+
+  //
+  // Everything below here only runs while the index is being built
+  //
+
+  // Mixes 'count' frames starting at 'start' down to mono.  Anything past the
+  // end of the buffer is silence.  'scratch' needs room for 'count' stereo
+  // frames.
+  static void read_mono(const SampleAudioBuffer *buffer, unsigned int start, unsigned int count, float *destination, float *scratch)
+  {
+    unsigned int available = count;
+    const float *block = buffer->read_block(start, available, scratch);
+    if(block == nullptr) available = 0;
+
+    if(buffer->channels == 1)
+    {
+      std::copy(block, block + available, destination);
+    }
+    else
+    {
+      for(unsigned int i = 0; i < available; i++) destination[i] = (block[2 * i] + block[(2 * i) + 1]) * 0.5f;
+    }
+
+    std::fill(destination + available, destination + count, 0.0f);
+  }
+
+  // Half-wave rectified difference between the log magnitude spectra of each
+  // window and the one before it.  The first window is compared to silence,
+  // so a sample that starts on a hit has an onset at the start.
+  static std::vector<float> spectral_flux(const SampleAudioBuffer *buffer)
+  {
+    unsigned int frame_count = buffer->size();
+    unsigned int window_count = ((frame_count - ONSET_INDEX_WINDOW_FRAMES) / ONSET_INDEX_HOP_FRAMES) + 1;
+    const unsigned int bins = ONSET_INDEX_WINDOW_FRAMES / 2;
+
+    std::vector<float> flux(window_count, 0.0f);
+    std::vector<float> hann(ONSET_INDEX_WINDOW_FRAMES);
+    std::vector<float> mono(ONSET_INDEX_WINDOW_FRAMES);
+    std::vector<float> scratch(ONSET_INDEX_HOP_FRAMES * 2);
+    std::vector<float> magnitudes(bins, std::log(ONSET_INDEX_MAGNITUDE_FLOOR));
+    std::vector<std::complex<float>> spectrum(ONSET_INDEX_WINDOW_FRAMES);
+    std::vector<std::complex<float>> twiddles(ONSET_INDEX_WINDOW_FRAMES / 2);
+
+    for(unsigned int i = 0; i < ONSET_INDEX_WINDOW_FRAMES; i++)
+    {
+      hann[i] = 0.5f - (0.5f * std::cos((2.0 * M_PI * i) / ONSET_INDEX_WINDOW_FRAMES));
+    }
+
+    for(unsigned int i = 0; i < twiddles.size(); i++)
+    {
+      twiddles[i] = std::polar(1.0f, (float) ((-2.0 * M_PI * i) / ONSET_INDEX_WINDOW_FRAMES));
+    }
+
+    // The first window is read whole, and after that each hop slides the
+    // window along and reads just the new frames onto its end
+    read_mono(buffer, 0, ONSET_INDEX_WINDOW_FRAMES - ONSET_INDEX_HOP_FRAMES, mono.data() + ONSET_INDEX_HOP_FRAMES, scratch.data());
+
+    for(unsigned int window = 0; window < window_count; window++)
+    {
+      std::copy(mono.begin() + ONSET_INDEX_HOP_FRAMES, mono.end(), mono.begin());
+      read_mono(buffer, (window * ONSET_INDEX_HOP_FRAMES) + ONSET_INDEX_WINDOW_FRAMES - ONSET_INDEX_HOP_FRAMES, ONSET_INDEX_HOP_FRAMES, mono.data() + ONSET_INDEX_WINDOW_FRAMES - ONSET_INDEX_HOP_FRAMES, scratch.data());
+
+      for(unsigned int i = 0; i < ONSET_INDEX_WINDOW_FRAMES; i++) spectrum[i] = std::complex<float>(mono[i] * hann[i], 0.0f);
+      fft(spectrum, twiddles);
+
+      float difference = 0.0f;
+
+      for(unsigned int bin = 1; bin < bins; bin++)
+      {
+        // Compressing the magnitudes lets quiet hits count for about as
+        // much as loud ones.  Anything under the floor is left out, so that
+        // background noise and window leakage don't look like hits.
+        float magnitude = 0.5f * std::log(std::max(ONSET_INDEX_MAGNITUDE_FLOOR * ONSET_INDEX_MAGNITUDE_FLOOR, std::norm(spectrum[bin])));
+        difference += std::max(0.0f, magnitude - magnitudes[bin]);
+        magnitudes[bin] = magnitude;
+      }
+
+      flux[window] = difference;
+    }
+
+    return(flux);
+  }
+
+  // The windows where the flux peaks well above what came just before it
+  static std::vector<unsigned int> pick_peaks(const std::vector<float> &flux)
+  {
+    std::vector<unsigned int> peaks;
+
+    for(size_t window = 0; window < flux.size(); window++)
+    {
+      size_t first = (window > ONSET_INDEX_PEAK_RADIUS) ? (window - ONSET_INDEX_PEAK_RADIUS) : 0;
+      size_t last = std::min(flux.size() - 1, window + (size_t) ONSET_INDEX_PEAK_RADIUS);
+
+      if(*std::max_element(flux.begin() + first, flux.begin() + last + 1) > flux[window]) continue;
+
+      // Steady noise has plenty of flux of its own, so the threshold rises
+      // and falls with the flux leading up to the window
+      size_t average_first = (window > ONSET_INDEX_AVERAGE_WINDOWS) ? (window - ONSET_INDEX_AVERAGE_WINDOWS) : 0;
+      float average = 0.0f;
+      for(size_t i = average_first; i < window; i++) average += flux[i];
+      if(window > average_first) average /= (window - average_first);
+
+      if(flux[window] >= (average * ONSET_INDEX_SENSITIVITY) + ONSET_INDEX_MINIMUM_FLUX) peaks.push_back((unsigned int) window);
+    }
+
+    return(peaks);
+  }
+
+  // The start of the ONSET_INDEX_REFINE_FRAMES stretch within 'count' frames
+  // from 'start' whose level rises the most over the stretch before it
+  static unsigned int refine(const SampleAudioBuffer *buffer, unsigned int start, unsigned int count, float *mono, float *scratch)
+  {
+    read_mono(buffer, start, count, mono, scratch);
+
+    // Before the start of the sample counts as silence
+    unsigned int best = start;
+    float best_rise = -1.0f;
+    float previous = -60.0f;
+
+    for(unsigned int offset = 0; offset + ONSET_INDEX_REFINE_FRAMES <= count; offset += ONSET_INDEX_REFINE_FRAMES)
+    {
+      float energy = 0.0f;
+      for(unsigned int i = offset; i < offset + ONSET_INDEX_REFINE_FRAMES; i++) energy += mono[i] * mono[i];
+
+      // In decibels, with a floor so that noise in near-silence doesn't look
+      // like a jump
+      float level = 10.0f * std::log10(energy + 1e-6f);
+
+      if(((offset > 0) || (start == 0)) && ((level - previous) > best_rise))
+      {
+        best_rise = level - previous;
+        best = start + offset;
+      }
+
+      previous = level;
+    }
+
+    return(std::min(best, buffer->size() - 1));
+  }
+
+  // In-place radix-2 FFT.  The size has to be a power of two, and
+  // 'twiddles' has to hold e^(-2 pi i k / size) for the first half of k.
+  static void fft(std::vector<std::complex<float>> &values, const std::vector<std::complex<float>> &twiddles)
+  {
+    size_t size = values.size();
+
+    for(size_t i = 1, j = 0; i < size; i++)
+    {
+      size_t bit = size >> 1;
+      for(; j & bit; bit >>= 1) j ^= bit;
+      j ^= bit;
+      if(i < j) std::swap(values[i], values[j]);
+    }
+
+    for(size_t length = 2; length <= size; length <<= 1)
+    {
+      size_t half = length / 2;
+      size_t stride = size / length;
+
+      for(size_t first = 0; first < size; first += length)
+      {
+        for(size_t k = 0; k < half; k++)
+        {
+          std::complex<float> even = values[first + k];
+          std::complex<float> odd = values[first + k + half] * twiddles[k * stride];
+          values[first + k] = even + odd;
+          values[first + k + half] = even - odd;
+        }
+      }
+    }
+  }
+};
+
+typedef std::shared_ptr<const OnsetIndex> OnsetIndexHandle;
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include "sample_encoding.hpp"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__)
+  #include <tmmintrin.h>
+#endif
+
+//
+// Bulk conversion between the PCM data in .wav and .aiff files and floats.
+//
+// decode_pcm() converts a whole run of interleaved frames and splits them into
+// one array per channel in the same pass.  encode_pcm() does the reverse.
+// The format and byte order are picked once per call rather than once per
+// sample, so the inner loops are straight-line code.  Mono and stereo floats,
+// which is nearly everything that gets loaded, go through SSE2 loops that
+// convert 8 values at a time.  24-bit audio needs SSSE3's byte shuffle for
+// that, which Rack's builds have, and falls back to the scalar loop
+// otherwise.
+//
+// The arithmetic is exactly what AudioFile did one sample at a time, so the
+// results are identical to the last bit.
+//
+
+enum PcmFormat
+{
+  PCM_UNSIGNED_8,
+  PCM_SIGNED_8,
+  PCM_INT16,
+  PCM_INT24,
+  PCM_INT32,
+  PCM_FLOAT32
+};
+
+inline size_t pcm_format_size(PcmFormat format)
+{
+  switch(format)
+  {
+    case PCM_INT16: return(2);
+    case PCM_INT24: return(3);
+    case PCM_INT32:
+    case PCM_FLOAT32: return(4);
+    default: return(1);
+  }
+}
+
+//
+// Scalar conversions for single values.  BIG is true for big endian data.
+//
+
+template <bool BIG>
+inline int32_t pcm_read_int16(const uint8_t *source)
+{
+  return(BIG ? (int16_t) ((source[0] << 8) | source[1]) : (int16_t) ((source[1] << 8) | source[0]));
+}
+
+// Puts the 24 bits in the top of an int32_t and shifts them back down, which
+// extends the sign without a branch
+template <bool BIG>
+inline int32_t pcm_read_int24(const uint8_t *source)
+{
+  uint32_t bits = BIG ? (((uint32_t) source[0] << 24) | ((uint32_t) source[1] << 16) | ((uint32_t) source[2] << 8)) : (((uint32_t) source[2] << 24) | ((uint32_t) source[1] << 16) | ((uint32_t) source[0] << 8));
+  return((int32_t) bits >> 8);
+}
+
+template <bool BIG>
+inline int32_t pcm_read_int32(const uint8_t *source)
+{
+  uint32_t bits = BIG ? (((uint32_t) source[0] << 24) | ((uint32_t) source[1] << 16) | ((uint32_t) source[2] << 8) | source[3]) : (((uint32_t) source[3] << 24) | ((uint32_t) source[2] << 16) | ((uint32_t) source[1] << 8) | source[0]);
+  return((int32_t) bits);
+}
+
+template <bool BIG>
+inline void pcm_write_bytes(uint32_t value, unsigned int size, uint8_t *destination)
+{
+  for(unsigned int i = 0; i < size; i++) destination[BIG ? (size - 1 - i) : i] = (uint8_t) (value >> (8 * i));
+}
+
+template <typename T>
+inline T pcm_clamp(T value)
+{
+  return(std::max(std::min(value, (T) 1.), (T) -1.));
+}
+
+template <typename T, PcmFormat FORMAT, bool BIG>
+inline T pcm_decode_value(const uint8_t *source)
+{
+  switch(FORMAT)
+  {
+    case PCM_UNSIGNED_8: return(static_cast<T>(source[0] - 128) / static_cast<T>(128.));
+    case PCM_SIGNED_8: return((T) (int8_t) source[0] / (T) 128.);
+    case PCM_INT16: return(static_cast<T>(pcm_read_int16<BIG>(source)) / static_cast<T>(32768.));
+    case PCM_INT24: return((T) pcm_read_int24<BIG>(source) / (T) 8388608.);
+    case PCM_INT32: return((T) pcm_read_int32<BIG>(source) / static_cast<float>(std::numeric_limits<int32_t>::max()));
+    case PCM_FLOAT32: return((T) bits_to_float((uint32_t) pcm_read_int32<BIG>(source)));
+  }
+
+  return(0);
+}
+
+template <typename T, PcmFormat FORMAT, bool BIG>
+inline void pcm_encode_value(T sample, uint8_t *destination)
+{
+  switch(FORMAT)
+  {
+    case PCM_UNSIGNED_8:
+      sample = (pcm_clamp(sample) + 1.) / 2.;
+      destination[0] = static_cast<uint8_t>(sample * 255.);
+      break;
+    case PCM_SIGNED_8:
+      destination[0] = (uint8_t) static_cast<int8_t>(pcm_clamp(sample) * 127.);
+      break;
+    case PCM_INT16:
+      pcm_write_bytes<BIG>((uint32_t) static_cast<int16_t>(pcm_clamp(sample) * 32767.), 2, destination);
+      break;
+    case PCM_INT24:
+      pcm_write_bytes<BIG>((uint32_t) (int32_t) (sample * (T) 8388608.), 3, destination);
+      break;
+    case PCM_INT32:
+      pcm_write_bytes<BIG>((uint32_t) (int32_t) (sample * std::numeric_limits<int32_t>::max()), 4, destination);
+      break;
+    case PCM_FLOAT32:
+      pcm_write_bytes<BIG>(float_to_bits((float) sample), 4, destination);
+      break;
+  }
+}
+
+//
+// SSE2 kernels.  Each step handles 8 interleaved values, which is 8 frames of
+// mono or 4 of stereo, held as two vectors of 4 floats.
+//
+
+#if defined(__SSE2__)
+
+inline bool pcm_has_sse_kernel(PcmFormat format)
+{
+  switch(format)
+  {
+    case PCM_INT16:
+    case PCM_INT32:
+    case PCM_FLOAT32: return(true);
+#if defined(__SSSE3__)
+    case PCM_INT24: return(true);
+#endif
+    default: return(false);
+  }
+}
+
+// The loads and stores for 24-bit audio run 4 bytes past the 24 bytes that a
+// step covers, so they need 2 more values to be there
+inline size_t pcm_sse_slack(PcmFormat format)
+{
+  return((format == PCM_INT24) ? 2 : 0);
+}
+
+inline __m128i pcm_swap_16_sse2(__m128i values)
+{
+  return(_mm_or_si128(_mm_slli_epi16(values, 8), _mm_srli_epi16(values, 8)));
+}
+
+inline __m128i pcm_swap_32_sse2(__m128i values)
+{
+  values = _mm_shufflehi_epi16(_mm_shufflelo_epi16(values, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+  return(pcm_swap_16_sse2(values));
+}
+
+template <PcmFormat FORMAT, bool BIG>
+inline void pcm_load_sse2(const uint8_t *source, __m128 &first, __m128 &second)
+{
+  switch(FORMAT)
+  {
+    case PCM_INT16:
+    {
+      const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+      __m128i values = _mm_loadu_si128((const __m128i *) source);
+      if(BIG) values = pcm_swap_16_sse2(values);
+
+      // Sign extend each 16-bit value to 32 bits by putting it in the top
+      // half of a 32-bit lane and shifting it back down
+      first = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16)), scale);
+      second = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16)), scale);
+      break;
+    }
+
+#if defined(__SSSE3__)
+    case PCM_INT24:
+    {
+      // Moves the 3 bytes of each value into the top of a 32-bit lane, then
+      // the same shift as above extends the sign
+      const __m128 scale = _mm_set1_ps(1.0f / 8388608.0f);
+      const __m128i spread = BIG ? _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9) : _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+      __m128i low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) source), spread);
+      __m128i high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (source + 12)), spread);
+
+      first = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(low, 8)), scale);
+      second = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(high, 8)), scale);
+      break;
+    }
+#endif
+
+    case PCM_INT32:
+    {
+      const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+      __m128i low = _mm_loadu_si128((const __m128i *) source);
+      __m128i high = _mm_loadu_si128((const __m128i *) (source + 16));
+      if(BIG) low = pcm_swap_32_sse2(low), high = pcm_swap_32_sse2(high);
+
+      first = _mm_mul_ps(_mm_cvtepi32_ps(low), scale);
+      second = _mm_mul_ps(_mm_cvtepi32_ps(high), scale);
+      break;
+    }
+
+    case PCM_FLOAT32:
+    {
+      __m128i low = _mm_loadu_si128((const __m128i *) source);
+      __m128i high = _mm_loadu_si128((const __m128i *) (source + 16));
+      if(BIG) low = pcm_swap_32_sse2(low), high = pcm_swap_32_sse2(high);
+
+      first = _mm_castsi128_ps(low);
+      second = _mm_castsi128_ps(high);
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+// Clamped values to 16 bits.  The scaling is done in double precision, like
+// the scalar version, so that the truncation lands in the same place.
+inline __m128i pcm_to_int16_range_sse2(__m128 values)
+{
+  const __m128d scale = _mm_set1_pd(32767.0);
+  values = _mm_max_ps(_mm_min_ps(values, _mm_set1_ps(1.0f)), _mm_set1_ps(-1.0f));
+
+  __m128i low = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(values), scale));
+  __m128i high = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(values, values)), scale));
+  return(_mm_unpacklo_epi64(low, high));
+}
+
+template <PcmFormat FORMAT, bool BIG>
+inline void pcm_store_sse2(__m128 first, __m128 second, uint8_t *destination)
+{
+  switch(FORMAT)
+  {
+    case PCM_INT16:
+    {
+      __m128i values = _mm_packs_epi32(pcm_to_int16_range_sse2(first), pcm_to_int16_range_sse2(second));
+      if(BIG) values = pcm_swap_16_sse2(values);
+      _mm_storeu_si128((__m128i *) destination, values);
+      break;
+    }
+
+#if defined(__SSSE3__)
+    case PCM_INT24:
+    {
+      // Packs the bottom 3 bytes of each lane into the first 12 bytes.  The
+      // second store writes over the first one's 4 leftover bytes, and the
+      // next step writes over the second one's.
+      const __m128 scale = _mm_set1_ps(8388608.0f);
+      const __m128i pack = BIG ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+      _mm_storeu_si128((__m128i *) destination, _mm_shuffle_epi8(_mm_cvttps_epi32(_mm_mul_ps(first, scale)), pack));
+      _mm_storeu_si128((__m128i *) (destination + 12), _mm_shuffle_epi8(_mm_cvttps_epi32(_mm_mul_ps(second, scale)), pack));
+      break;
+    }
+#endif
+
+    case PCM_INT32:
+    {
+      const __m128 scale = _mm_set1_ps(2147483648.0f);
+      __m128i low = _mm_cvttps_epi32(_mm_mul_ps(first, scale));
+      __m128i high = _mm_cvttps_epi32(_mm_mul_ps(second, scale));
+      if(BIG) low = pcm_swap_32_sse2(low), high = pcm_swap_32_sse2(high);
+
+      _mm_storeu_si128((__m128i *) destination, low);
+      _mm_storeu_si128((__m128i *) (destination + 16), high);
+      break;
+    }
+
+    case PCM_FLOAT32:
+    {
+      __m128i low = _mm_castps_si128(first);
+      __m128i high = _mm_castps_si128(second);
+      if(BIG) low = pcm_swap_32_sse2(low), high = pcm_swap_32_sse2(high);
+
+      _mm_storeu_si128((__m128i *) destination, low);
+      _mm_storeu_si128((__m128i *) (destination + 16), high);
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+#endif
+
+// Converts as many frames as the SIMD loop can and returns how many that was.
+// Only float arrays have a SIMD loop.
+template <PcmFormat FORMAT, bool BIG, typename T>
+inline size_t decode_pcm_simd(const uint8_t *, unsigned int, size_t, T *const *)
+{
+  return(0);
+}
+
+template <PcmFormat FORMAT, bool BIG>
+inline size_t decode_pcm_simd(const uint8_t *source, unsigned int channels, size_t frames, float *const *destinations)
+{
+  size_t frame = 0;
+
+#if defined(__SSE2__)
+  if((channels > 2) || (! pcm_has_sse_kernel(FORMAT))) return(0);
+
+  const size_t step = 8 / channels;
+  const size_t step_bytes = 8 * pcm_format_size(FORMAT);
+  const size_t values = frames * channels;
+  __m128 first, second;
+
+  for(; ((frame * channels) + 8 + pcm_sse_slack(FORMAT)) <= values; frame += step, source += step_bytes)
+  {
+    pcm_load_sse2<FORMAT, BIG>(source, first, second);
+
+    if(channels == 1)
+    {
+      _mm_storeu_ps(destinations[0] + frame, first);
+      _mm_storeu_ps(destinations[0] + frame + 4, second);
+    }
+    else
+    {
+      _mm_storeu_ps(destinations[0] + frame, _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(destinations[1] + frame, _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+  }
+#endif
+
+  return(frame);
+}
+
+template <PcmFormat FORMAT, bool BIG, typename T>
+inline size_t encode_pcm_simd(const T *const *, unsigned int, size_t, uint8_t *)
+{
+  return(0);
+}
+
+template <PcmFormat FORMAT, bool BIG>
+inline size_t encode_pcm_simd(const float *const *sources, unsigned int channels, size_t frames, uint8_t *destination)
+{
+  size_t frame = 0;
+
+#if defined(__SSE2__)
+  if((channels > 2) || (! pcm_has_sse_kernel(FORMAT))) return(0);
+
+  const size_t step = 8 / channels;
+  const size_t step_bytes = 8 * pcm_format_size(FORMAT);
+  const size_t values = frames * channels;
+
+  for(; ((frame * channels) + 8 + pcm_sse_slack(FORMAT)) <= values; frame += step, destination += step_bytes)
+  {
+    if(channels == 1)
+    {
+      pcm_store_sse2<FORMAT, BIG>(_mm_loadu_ps(sources[0] + frame), _mm_loadu_ps(sources[0] + frame + 4), destination);
+    }
+    else
+    {
+      __m128 left = _mm_loadu_ps(sources[0] + frame);
+      __m128 right = _mm_loadu_ps(sources[1] + frame);
+      pcm_store_sse2<FORMAT, BIG>(_mm_unpacklo_ps(left, right), _mm_unpackhi_ps(left, right), destination);
+    }
+  }
+#endif
+
+  return(frame);
+}
+
+template <typename T, PcmFormat FORMAT, bool BIG>
+void decode_pcm_frames(const uint8_t *source, unsigned int channels, size_t frames, T *const *destinations)
+{
+  const size_t size = pcm_format_size(FORMAT);
+  size_t frame = decode_pcm_simd<FORMAT, BIG>(source, channels, frames, destinations);
+  source += frame * channels * size;
+
+  if(channels == 1)
+  {
+    for(; frame < frames; frame++, source += size) destinations[0][frame] = pcm_decode_value<T, FORMAT, BIG>(source);
+  }
+  else if(channels == 2)
+  {
+    for(; frame < frames; frame++, source += 2 * size)
+    {
+      destinations[0][frame] = pcm_decode_value<T, FORMAT, BIG>(source);
+      destinations[1][frame] = pcm_decode_value<T, FORMAT, BIG>(source + size);
+    }
+  }
+  else
+  {
+    for(; frame < frames; frame++)
+    {
+      for(unsigned int channel = 0; channel < channels; channel++, source += size) destinations[channel][frame] = pcm_decode_value<T, FORMAT, BIG>(source);
+    }
+  }
+}
+
+template <typename T, PcmFormat FORMAT, bool BIG>
+void encode_pcm_frames(const T *const *sources, unsigned int channels, size_t frames, uint8_t *destination)
+{
+  const size_t size = pcm_format_size(FORMAT);
+  size_t frame = encode_pcm_simd<FORMAT, BIG>(sources, channels, frames, destination);
+  destination += frame * channels * size;
+
+  if(channels == 1)
+  {
+    for(; frame < frames; frame++, destination += size) pcm_encode_value<T, FORMAT, BIG>(sources[0][frame], destination);
+  }
+  else if(channels == 2)
+  {
+    for(; frame < frames; frame++, destination += 2 * size)
+    {
+      pcm_encode_value<T, FORMAT, BIG>(sources[0][frame], destination);
+      pcm_encode_value<T, FORMAT, BIG>(sources[1][frame], destination + size);
+    }
+  }
+  else
+  {
+    for(; frame < frames; frame++)
+    {
+      for(unsigned int channel = 0; channel < channels; channel++, destination += size) pcm_encode_value<T, FORMAT, BIG>(sources[channel][frame], destination);
+    }
+  }
+}
+
+template <typename T, bool BIG>
+void decode_pcm_in_order(const uint8_t *source, PcmFormat format, unsigned int channels, size_t frames, T *const *destinations)
+{
+  switch(format)
+  {
+    case PCM_UNSIGNED_8: decode_pcm_frames<T, PCM_UNSIGNED_8, BIG>(source, channels, frames, destinations); break;
+    case PCM_SIGNED_8: decode_pcm_frames<T, PCM_SIGNED_8, BIG>(source, channels, frames, destinations); break;
+    case PCM_INT16: decode_pcm_frames<T, PCM_INT16, BIG>(source, channels, frames, destinations); break;
+    case PCM_INT24: decode_pcm_frames<T, PCM_INT24, BIG>(source, channels, frames, destinations); break;
+    case PCM_INT32: decode_pcm_frames<T, PCM_INT32, BIG>(source, channels, frames, destinations); break;
+    case PCM_FLOAT32: decode_pcm_frames<T, PCM_FLOAT32, BIG>(source, channels, frames, destinations); break;
+  }
+}
+
+template <typename T, bool BIG>
+void encode_pcm_in_order(const T *const *sources, unsigned int channels, size_t frames, PcmFormat format, uint8_t *destination)
+{
+  switch(format)
+  {
+    case PCM_UNSIGNED_8: encode_pcm_frames<T, PCM_UNSIGNED_8, BIG>(sources, channels, frames, destination); break;
+    case PCM_SIGNED_8: encode_pcm_frames<T, PCM_SIGNED_8, BIG>(sources, channels, frames, destination); break;
+    case PCM_INT16: encode_pcm_frames<T, PCM_INT16, BIG>(sources, channels, frames, destination); break;
+    case PCM_INT24: encode_pcm_frames<T, PCM_INT24, BIG>(sources, channels, frames, destination); break;
+    case PCM_INT32: encode_pcm_frames<T, PCM_INT32, BIG>(sources, channels, frames, destination); break;
+    case PCM_FLOAT32: encode_pcm_frames<T, PCM_FLOAT32, BIG>(sources, channels, frames, destination); break;
+  }
+}
+
+//
+// Converts 'frames' interleaved frames of 'channels' channels, starting at
+// 'source', into the arrays in 'destinations', one per channel
+//
+template <typename T>
+void decode_pcm(const uint8_t *source, PcmFormat format, bool big_endian, unsigned int channels, size_t frames, T *const *destinations)
+{
+  if(big_endian) decode_pcm_in_order<T, true>(source, format, channels, frames, destinations);
+  else decode_pcm_in_order<T, false>(source, format, channels, frames, destinations);
+}
+
+//
+// Interleaves 'frames' frames from the arrays in 'sources', one per channel,
+// into 'destination', which needs room for frames * channels values
+//
+template <typename T>
+void encode_pcm(const T *const *sources, unsigned int channels, size_t frames, PcmFormat format, bool big_endian, uint8_t *destination)
+{
+  if(big_endian) encode_pcm_in_order<T, true>(sources, channels, frames, format, destination);
+  else encode_pcm_in_order<T, false>(sources, channels, frames, format, destination);
+}
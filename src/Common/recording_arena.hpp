@@ -0,0 +1,343 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include "aligned_memory.hpp"
+#include "sample_loader.hpp"
+
+// Stereo frames per chunk.  At 48k this is a little under a second and a half
+// of audio, in 512 KB.
+#define RECORDING_ARENA_CHUNK_FRAMES 65536
+
+// How many chunks past the one being recorded into are kept ready.  The
+// housekeeping thread tops them up every SAMPLE_LOADER_HOUSEKEEPING_INTERVAL
+// milliseconds, which is far shorter than it takes to fill a chunk.
+#define RECORDING_ARENA_CHUNKS_AHEAD 2
+
+//
+// RecordingChunks holds one recording as a list of fixed-size chunks of
+// interleaved stereo floats.  The table of chunk pointers is sized for the
+// longest recording that a frame index can address, so it never has to grow.
+//
+
+struct RecordingChunks
+{
+  std::vector<float *> chunks;
+
+  // Number of chunks, from the start of 'chunks', that are ready to record into
+  std::atomic<unsigned int> committed;
+
+  // The chunk that the audio thread is recording into
+  std::atomic<unsigned int> in_use;
+
+  RecordingChunks() : committed(0), in_use(0)
+  {
+    chunks.resize(((size_t) std::numeric_limits<unsigned int>::max() / RECORDING_ARENA_CHUNK_FRAMES) + 1, nullptr);
+  }
+
+  ~RecordingChunks()
+  {
+    for(float *chunk : chunks) aligned_free(chunk);
+  }
+
+  RecordingChunks(const RecordingChunks &) = delete;
+  RecordingChunks &operator=(const RecordingChunks &) = delete;
+
+  // Not on the audio thread.  Allocates chunks until 'wanted' are ready.
+  void commit(unsigned int wanted)
+  {
+    for(unsigned int index = committed.load(); index < wanted; index++)
+    {
+      float *chunk = (float *) aligned_malloc(RECORDING_ARENA_CHUNK_FRAMES * 2 * sizeof(float));
+      if(chunk == nullptr) break;
+
+      // Writing to every page makes the operating system commit it now
+      // rather than on the audio thread.
+      std::memset(chunk, 0, RECORDING_ARENA_CHUNK_FRAMES * 2 * sizeof(float));
+
+      chunks[index] = chunk;
+      committed.store(index + 1, std::memory_order_release);
+    }
+  }
+
+  float *frame(unsigned int index) const
+  {
+    return(chunks[index / RECORDING_ARENA_CHUNK_FRAMES] + (2 * (size_t) (index % RECORDING_ARENA_CHUNK_FRAMES)));
+  }
+
+  // Copies 'count' interleaved stereo frames, starting at 'start', which have
+  // to have been recorded already.  Frame indexes are ANDed with 'mask', so
+  // that copies out of a ring wrap around.  See CaptureRing.
+  void copy(unsigned int start, unsigned int count, float *destination, unsigned int mask = std::numeric_limits<unsigned int>::max()) const
+  {
+    while(count > 0)
+    {
+      start &= mask;
+      unsigned int run = std::min(count, RECORDING_ARENA_CHUNK_FRAMES - (start % RECORDING_ARENA_CHUNK_FRAMES));
+      std::memcpy(destination, frame(start), (size_t) run * 2 * sizeof(float));
+      destination += (size_t) run * 2;
+      start += run;
+      count -= run;
+    }
+  }
+};
+
+typedef std::shared_ptr<RecordingChunks> RecordingChunksHandle;
+
+//
+// A finished recording, as handed out by RecordingArena::finish() or
+// CaptureRing::commit().  Nothing ever writes to its chunks again, so it can
+// be read from any thread.
+//
+// A take that was cut out of a ring starts part way into its chunks and
+// wraps around at the end of them.  Frame 'index' of the take is at
+// ('start' + index) & 'mask' in the chunks.
+//
+
+struct RecordedTake
+{
+  RecordingChunksHandle audio;
+  unsigned int frame_count = 0;
+  unsigned int sample_rate = 0;
+  unsigned int start = 0;
+  unsigned int mask = std::numeric_limits<unsigned int>::max();
+
+  std::pair<float, float> read(unsigned int index) const
+  {
+    if(index >= frame_count) return {0.0, 0.0};
+    const float *frame = audio->frame((start + index) & mask);
+    return {frame[0], frame[1]};
+  }
+
+  // Copies 'count' interleaved stereo frames, starting at frame 'first'
+  void copy(unsigned int first, unsigned int count, float *destination) const
+  {
+    count = std::min(count, (first < frame_count) ? (frame_count - first) : 0);
+    if(count > 0) audio->copy(start + first, count, destination, mask);
+  }
+};
+
+//
+// RecordingArenaControl is shared between the arena, on the audio thread, and
+// its housekeeping task.  Housekeeping keeps the recording's chunks topped up,
+// and keeps a spare set ready to take over when a finished recording is
+// handed out.  Handles are passed back and forth through 'spare' and
+// 'retired' the same way SampleSwap passes samples, so the audio thread never
+// allocates or frees anything.
+//
+
+struct RecordingArenaControl
+{
+  // The chunks being recorded into.  The arena holds their handle.
+  std::atomic<RecordingChunks *> current;
+
+  std::atomic<RecordingChunksHandle *> spare;
+  std::atomic<RecordingChunksHandle *> retired;
+
+  std::atomic<unsigned int> maximum_frames;
+  std::atomic<unsigned int> sample_rate;
+
+  // The arena's chunks, once the arena is gone.  Housekeeping might still be
+  // topping them up, so they're released along with this.
+  RecordingChunksHandle orphaned;
+
+  // Set when the arena goes away, so that the housekeeping task stops
+  std::atomic<bool> closed;
+
+  RecordingArenaControl(unsigned int maximum_frames, unsigned int sample_rate) : current(nullptr), spare(nullptr), retired(nullptr), maximum_frames(maximum_frames), sample_rate(sample_rate), closed(false)
+  {
+  }
+
+  ~RecordingArenaControl()
+  {
+    delete spare.load();
+    delete retired.load();
+  }
+
+  unsigned int maximum_chunks()
+  {
+    return((unsigned int) (((size_t) maximum_frames + RECORDING_ARENA_CHUNK_FRAMES - 1) / RECORDING_ARENA_CHUNK_FRAMES));
+  }
+
+  unsigned int ready_chunks(unsigned int in_use)
+  {
+    return(std::min(in_use + 1 + RECORDING_ARENA_CHUNKS_AHEAD, maximum_chunks()));
+  }
+
+  // Housekeeping thread.  Returns true once the arena is gone.  Retired
+  // handles are only ever released here, so 'current' can't be freed out
+  // from under this while it's being topped up.
+  bool maintain()
+  {
+    if(closed) return(true);
+
+    delete retired.exchange(nullptr, std::memory_order_acq_rel);
+
+    RecordingChunks *chunks = current.load(std::memory_order_acquire);
+    if(chunks != nullptr) chunks->commit(ready_chunks(chunks->in_use.load()));
+
+    if(spare.load(std::memory_order_acquire) == nullptr)
+    {
+      RecordingChunksHandle *handle = new RecordingChunksHandle(std::make_shared<RecordingChunks>());
+      (*handle)->commit(ready_chunks(0));
+      spare.store(handle, std::memory_order_release);
+    }
+
+    return(false);
+  }
+};
+
+//
+// RecordingArena is what a Sample records into.  The audio thread only ever
+// writes into chunks that have already been allocated and zeroed, so
+// recording never allocates, never copies what's already been recorded, and
+// never touches a page of memory for the first time.
+//
+// finish() hands the recording out as a RecordedTake, without copying it, and
+// the spare chunks take its place.  If the spare isn't ready yet, which can
+// only happen when takes are finished a few milliseconds apart, frames are
+// dropped until it is.  Frames past the maximum length are dropped too.
+//
+// configure() has to be called, off of the audio thread, before recording.
+//
+
+struct RecordingArena
+{
+  std::shared_ptr<RecordingArenaControl> control;
+  std::shared_ptr<SampleLoader> loader;
+  RecordingChunksHandle chunks;
+
+  // False from when 'chunks' are handed out until the spare replaces them
+  bool fresh = false;
+
+  unsigned int frame_count = 0;
+  unsigned int dropped_frames = 0;
+
+  RecordingArena()
+  {
+  }
+
+  ~RecordingArena()
+  {
+    if(control)
+    {
+      control->orphaned.swap(chunks);
+      control->closed = true;
+    }
+  }
+
+  RecordingArena(const RecordingArena &) = delete;
+  RecordingArena &operator=(const RecordingArena &) = delete;
+
+  // The chunks and the housekeeping go with the move, and the old arena is
+  // left unconfigured
+  RecordingArena(RecordingArena &&) = default;
+
+  // Not on the audio thread.  Sets the longest recording, in frames, and the
+  // sample rate that finished takes are tagged with.  The first time this is
+  // called, it allocates the first few chunks right away and starts the
+  // housekeeping task that keeps them coming.
+  void configure(unsigned int maximum_frames, unsigned int sample_rate)
+  {
+    if(control)
+    {
+      control->maximum_frames = maximum_frames;
+      control->sample_rate = sample_rate;
+      return;
+    }
+
+    control = std::make_shared<RecordingArenaControl>(maximum_frames, sample_rate);
+    chunks = std::make_shared<RecordingChunks>();
+    control->current = chunks.get();
+    fresh = true;
+    control->maintain();
+
+    std::shared_ptr<RecordingArenaControl> shared_control = control;
+    loader = get_sample_loader();
+    loader->housekeeping([shared_control]() { return shared_control->maintain(); });
+  }
+
+  bool is_configured()
+  {
+    return(control != nullptr);
+  }
+
+  // Audio thread.  Start a new recording.  Unless the last one was handed
+  // out, this records over the top of it, reusing its chunks.
+  void reset()
+  {
+    frame_count = 0;
+    dropped_frames = 0;
+    if(control && (fresh || take_spare())) chunks->in_use.store(0, std::memory_order_relaxed);
+  }
+
+  // Audio thread.  Returns false, and drops the frame, if the recording is
+  // at its maximum length or the next chunk isn't ready yet.
+  bool push(float left, float right)
+  {
+    if((! control) || (frame_count >= control->maximum_frames.load(std::memory_order_relaxed)) || ((! fresh) && (! take_spare())))
+    {
+      dropped_frames++;
+      return(false);
+    }
+
+    unsigned int chunk_index = frame_count / RECORDING_ARENA_CHUNK_FRAMES;
+
+    if(chunk_index >= chunks->committed.load(std::memory_order_acquire))
+    {
+      dropped_frames++;
+      return(false);
+    }
+
+    if((frame_count % RECORDING_ARENA_CHUNK_FRAMES) == 0) chunks->in_use.store(chunk_index, std::memory_order_relaxed);
+
+    float *frame = chunks->frame(frame_count);
+    frame[0] = left;
+    frame[1] = right;
+    frame_count++;
+
+    return(true);
+  }
+
+  // Audio thread.  Hands the recording to 'take'.  'take' has to be empty, so
+  // that letting go of whatever it held can't free memory here.
+  void finish(RecordedTake &take)
+  {
+    if(! control) return;
+
+    take.audio = chunks;
+    take.frame_count = frame_count;
+    take.sample_rate = control->sample_rate;
+
+    fresh = false;
+    take_spare();
+  }
+
+  // Audio thread.  Swaps the spare chunks in for the ones that were handed
+  // out, and leaves the old handle for housekeeping to release.
+  bool take_spare()
+  {
+    if(control->retired.load(std::memory_order_acquire) != nullptr) return(false);
+
+    RecordingChunksHandle *spare = control->spare.exchange(nullptr, std::memory_order_acq_rel);
+    if(spare == nullptr) return(false);
+
+    chunks.swap(*spare);
+    chunks->in_use.store(frame_count / RECORDING_ARENA_CHUNK_FRAMES, std::memory_order_relaxed);
+    control->current.store(chunks.get(), std::memory_order_release);
+    control->retired.store(spare, std::memory_order_release);
+    fresh = true;
+
+    return(true);
+  }
+
+  unsigned int size()
+  {
+    return(frame_count);
+  }
+};
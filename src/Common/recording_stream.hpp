@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <ctime>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "aligned_memory.hpp"
+#include "file_system.hpp"
+#include "wav_writer.hpp"
+#include "sample_writer.hpp"
+
+// Frames in each block that's handed to the writer.  The header is updated
+// after every block, so this is the most that a crash can lose.  At 48k it's
+// about a third of a second.
+#define RECORDING_STREAM_BLOCK_FRAMES 16384
+
+// Blocks in the ring between the audio thread and the writer.  This is how
+// far the writer can fall behind, such as while the disk is busy, before
+// frames are dropped.  At 48k, 16 blocks is about five and a half seconds.
+#define RECORDING_STREAM_BLOCKS 16
+
+#define RECORDING_STREAM_CAPACITY (RECORDING_STREAM_BLOCK_FRAMES * RECORDING_STREAM_BLOCKS)
+
+enum RecordingStreamState {
+  RECORDING_STREAM_IDLE,
+  RECORDING_STREAM_RECORDING,
+  RECORDING_STREAM_STOPPING
+};
+
+//
+// RecordingStream records straight to a .wav file, a block at a time, so that
+// a take can be as long as a .wav file allows while using the same small,
+// fixed amount of memory the whole time.
+//
+// The audio thread writes frames into a ring of blocks.  The SampleWriter
+// appends each block to the file once it's full, and patches the sizes in
+// the header and syncs the file after every block.  Until the take is
+// stopped, the file is written under a name of its own in 'folder', where
+// it's a valid .wav file holding everything but the last block, even if Rack
+// crashes.  Once stopped, it's renamed to its destination.
+//
+// The writer services the stream through a task, which is added by
+// attach().  When the owner lets go of the stream part way through a take,
+// the file is closed as it is and left under its unfinished name.
+//
+
+struct RecordingStream
+{
+  float *frames = nullptr;
+  std::string folder;
+  unsigned int sample_rate = 44100;
+
+  // Audio thread.  Frames recorded so far in this take, and frames dropped.
+  uint64_t position = 0;
+  unsigned int dropped_frames = 0;
+
+  // Frames that the audio thread has handed over, which is always a whole
+  // number of blocks until the take is stopped, and frames that are on disk
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> consumed;
+
+  std::atomic<int> state;
+
+  // Set by the audio thread before it moves the state to STOPPING
+  FixedPath destination;
+  unsigned int take_number = 0;
+  std::shared_ptr<SampleWriterStatus> status;
+
+  // Writer thread
+  WavWriter file;
+  std::string unfinished_path;
+  bool started = false;
+  bool failed = false;
+
+  // Set when the stream's owner lets go of it
+  std::atomic<bool> closed;
+
+  RecordingStream(const std::string &folder, std::shared_ptr<SampleWriterStatus> status) : folder(folder), written(0), consumed(0), state(RECORDING_STREAM_IDLE), status(status), closed(false)
+  {
+    frames = (float *) aligned_malloc((size_t) RECORDING_STREAM_CAPACITY * 2 * sizeof(float));
+
+    // Writing to every page makes the operating system commit it now rather
+    // than on the audio thread
+    if(frames != nullptr) std::memset(frames, 0, (size_t) RECORDING_STREAM_CAPACITY * 2 * sizeof(float));
+  }
+
+  ~RecordingStream()
+  {
+    aligned_free(frames);
+  }
+
+  RecordingStream(const RecordingStream &) = delete;
+  RecordingStream &operator=(const RecordingStream &) = delete;
+
+  // Audio thread.  Returns false if the last take is still being finished.
+  bool start(unsigned int sample_rate)
+  {
+    if((frames == nullptr) || (state.load(std::memory_order_acquire) != RECORDING_STREAM_IDLE)) return(false);
+
+    this->sample_rate = sample_rate;
+    position = 0;
+    dropped_frames = 0;
+    written.store(0, std::memory_order_relaxed);
+    state.store(RECORDING_STREAM_RECORDING, std::memory_order_release);
+
+    return(true);
+  }
+
+  // Audio thread.  Drops the frame if the writer has fallen too far behind,
+  // or the file is as large as a .wav file can be.
+  bool push(float left, float right)
+  {
+    if(state.load(std::memory_order_relaxed) != RECORDING_STREAM_RECORDING) return(false);
+
+    if(((position - consumed.load(std::memory_order_acquire)) >= RECORDING_STREAM_CAPACITY) || (position >= WavWriter::maximum_frames(2)))
+    {
+      dropped_frames++;
+      return(false);
+    }
+
+    float *frame = frames + (2 * (size_t) (position % RECORDING_STREAM_CAPACITY));
+    frame[0] = left;
+    frame[1] = right;
+    position++;
+
+    if((position % RECORDING_STREAM_BLOCK_FRAMES) == 0) written.store(position, std::memory_order_release);
+
+    return(true);
+  }
+
+  // Audio thread.  Hands over the last partial block and has the writer
+  // finish the file and move it to 'destination'.  'status' hears about it
+  // under 'take_number'.
+  void stop(const FixedPath &destination, unsigned int take_number)
+  {
+    if(state.load(std::memory_order_relaxed) != RECORDING_STREAM_RECORDING) return;
+
+    this->destination = destination;
+    this->take_number = take_number;
+    written.store(position, std::memory_order_release);
+    state.store(RECORDING_STREAM_STOPPING, std::memory_order_release);
+  }
+
+  // Not on the audio thread.  Has 'writer' look after this stream until it's
+  // closed.
+  static void attach(std::shared_ptr<RecordingStream> stream, std::shared_ptr<SampleWriter> writer)
+  {
+    writer->add_task([stream]() { return stream->service(); });
+  }
+
+  // Writer thread.  Writes whatever's ready.  Returns true once the stream
+  // is closed and has nothing left to write.
+  bool service()
+  {
+    int current_state = state.load(std::memory_order_acquire);
+
+    if(current_state == RECORDING_STREAM_IDLE) return(closed);
+
+    if(! started)
+    {
+      // Named after the time the take started, so that a take that was cut
+      // short by a crash isn't overwritten by the next session
+      static std::atomic<unsigned int> counter(0);
+      unfinished_path = folder + "/unfinished_recording_" + std::to_string((long long) std::time(nullptr)) + "_" + std::to_string(++counter) + ".wav";
+      failed = ! file.open(unfinished_path, 2, sample_rate);
+      started = true;
+    }
+
+    // Once something's gone wrong, frames are still taken off of the audio
+    // thread's hands, but they go nowhere
+    uint64_t available = written.load(std::memory_order_acquire);
+    uint64_t done = consumed.load(std::memory_order_relaxed);
+
+    while(done < available)
+    {
+      unsigned int offset = (unsigned int) (done % RECORDING_STREAM_CAPACITY);
+      unsigned int count = (unsigned int) std::min(available - done, (uint64_t) (RECORDING_STREAM_BLOCK_FRAMES - (offset % RECORDING_STREAM_BLOCK_FRAMES)));
+
+      if(! failed) failed = ! (file.write(frames + (2 * (size_t) offset), count) && file.update_header());
+
+      done += count;
+      consumed.store(done, std::memory_order_release);
+    }
+
+    if(current_state == RECORDING_STREAM_STOPPING)
+    {
+      bool saved = file.close() && (! failed) && replace_file(unfinished_path, destination.c_str());
+      if(status) (saved ? status->saved_take : status->failed_take).store(take_number, std::memory_order_release);
+    }
+    else if(closed)
+    {
+      file.close();
+    }
+    else
+    {
+      return(false);
+    }
+
+    started = false;
+    consumed.store(0, std::memory_order_release);
+    state.store(RECORDING_STREAM_IDLE, std::memory_order_release);
+
+    return(closed);
+  }
+};
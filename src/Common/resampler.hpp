@@ -0,0 +1,183 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Kernel half-width, in input frames, when the rate goes up.  Going down, the
+// kernel is widened to match the lower cutoff.
+#define RESAMPLER_HALF_TAPS 32
+
+// Fraction of the output's Nyquist frequency that's kept.  The rest is the
+// transition band.
+#define RESAMPLER_BANDWIDTH 0.94
+
+// Kaiser window shape.  Higher means more stopband rejection and a wider
+// transition.
+#define RESAMPLER_KAISER_BETA 8.0
+
+// Most rate pairs, such as 48000 to 44100, only need a few hundred phases.
+// Unusual pairs would need far more, so past this many the kernel is
+// interpolated between neighbouring phases instead.
+#define RESAMPLER_MAXIMUM_PHASES 1024
+
+//
+// PolyphaseResampler converts interleaved float audio from one sample rate to
+// another using a windowed-sinc kernel.  The ratio between the rates is
+// reduced to 'up' / 'down', and output frame n lands at input position
+// n * down / up.  The kernel is precomputed for each of the fractional
+// positions that can come up, so every output frame is a plain dot product.
+//
+// This is too slow for the audio thread.  It's meant to be run once, on the
+// loader thread, when a sample is loaded.
+//
+
+struct PolyphaseResampler
+{
+  uint64_t up = 1;
+  uint64_t down = 1;
+  unsigned int half_taps = RESAMPLER_HALF_TAPS;
+  unsigned int phases = 1;
+
+  // (phases + 1) rows of (2 * half_taps) weights.  The extra row is the first
+  // one shifted by a whole frame, so that interpolating between phases never
+  // runs off the end.
+  std::vector<float> kernel;
+
+  PolyphaseResampler(unsigned int input_rate, unsigned int output_rate)
+  {
+    uint64_t divisor = greatest_common_divisor(input_rate, output_rate);
+    up = output_rate / divisor;
+    down = input_rate / divisor;
+
+    double cutoff = std::min(1.0, (double) output_rate / (double) input_rate) * RESAMPLER_BANDWIDTH;
+    half_taps = (unsigned int) std::ceil(RESAMPLER_HALF_TAPS / std::min(1.0, (double) output_rate / (double) input_rate));
+    phases = (unsigned int) std::min(up, (uint64_t) RESAMPLER_MAXIMUM_PHASES);
+
+    unsigned int taps = 2 * half_taps;
+    kernel.resize((size_t) (phases + 1) * taps);
+
+    for(unsigned int phase = 0; phase <= phases; phase++)
+    {
+      float *weights = &kernel[(size_t) phase * taps];
+      double fraction = (double) phase / phases;
+      double sum = 0.0;
+
+      for(unsigned int tap = 0; tap < taps; tap++)
+      {
+        // Distance from the output position to this tap's input frame
+        double distance = fraction + half_taps - 1 - tap;
+        weights[tap] = (float) (cutoff * sinc(cutoff * distance) * kaiser(distance / half_taps));
+        sum += weights[tap];
+      }
+
+      // Unity gain at DC for every phase
+      for(unsigned int tap = 0; tap < taps; tap++) weights[tap] = (float) (weights[tap] / sum);
+    }
+  }
+
+  // How many frames 'input_frames' frames turn into
+  uint64_t output_length(uint64_t input_frames)
+  {
+    return(((input_frames * up) + down - 1) / down);
+  }
+
+  // Computes 'count' output frames, starting at output frame 'first', from
+  // the 'input_frames' frames of interleaved 'input'.  Frames before the
+  // start and after the end of the input count as silence.
+  void process(const float *input, uint64_t input_frames, unsigned int channels, uint64_t first, size_t count, float *output)
+  {
+    unsigned int taps = 2 * half_taps;
+    std::vector<float> interpolated(taps);
+
+    for(size_t n = 0; n < count; n++)
+    {
+      uint64_t position = (first + n) * down;
+      uint64_t index = position / up;
+      uint64_t remainder = position % up;
+
+      const float *row;
+
+      if(phases == up)
+      {
+        row = &kernel[(size_t) remainder * taps];
+      }
+      else
+      {
+        double phase_position = (double) remainder * phases / up;
+        unsigned int phase = std::min((unsigned int) phase_position, phases - 1);
+        float blend = (float) (phase_position - phase);
+        const float *a = &kernel[(size_t) phase * taps];
+        const float *b = a + taps;
+        for(unsigned int tap = 0; tap < taps; tap++) interpolated[tap] = a[tap] + ((b[tap] - a[tap]) * blend);
+        row = interpolated.data();
+      }
+
+      // The first input frame under the kernel, which can be before the start
+      int64_t start = (int64_t) index - half_taps + 1;
+      float *frame = output + (n * channels);
+
+      for(unsigned int channel = 0; channel < channels; channel++)
+      {
+        float total = 0.0f;
+
+        if((start >= 0) && ((uint64_t) start + taps <= input_frames))
+        {
+          const float *source = input + ((size_t) start * channels) + channel;
+          for(unsigned int tap = 0; tap < taps; tap++) total += source[(size_t) tap * channels] * row[tap];
+        }
+        else
+        {
+          for(unsigned int tap = 0; tap < taps; tap++)
+          {
+            int64_t source_index = start + tap;
+            if((source_index >= 0) && ((uint64_t) source_index < input_frames)) total += input[((size_t) source_index * channels) + channel] * row[tap];
+          }
+        }
+
+        frame[channel] = total;
+      }
+    }
+  }
+
+  static uint64_t greatest_common_divisor(uint64_t a, uint64_t b)
+  {
+    while(b != 0)
+    {
+      uint64_t remainder = a % b;
+      a = b;
+      b = remainder;
+    }
+    return((a == 0) ? 1 : a);
+  }
+
+  static double sinc(double x)
+  {
+    if(std::fabs(x) < 1e-9) return(1.0);
+    return(std::sin(M_PI * x) / (M_PI * x));
+  }
+
+  // Zeroth-order modified Bessel function of the first kind, by its series
+  static double bessel_i0(double x)
+  {
+    double sum = 1.0;
+    double term = 1.0;
+
+    for(int k = 1; k < 50; k++)
+    {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+      if(term < sum * 1e-12) break;
+    }
+
+    return(sum);
+  }
+
+  static double kaiser(double x)
+  {
+    if(std::fabs(x) >= 1.0) return(0.0);
+    return(bessel_i0(RESAMPLER_KAISER_BETA * std::sqrt(1.0 - (x * x))) / bessel_i0(RESAMPLER_KAISER_BETA));
+  }
+};
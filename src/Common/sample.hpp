@@ -1,153 +1,836 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
 #include "AudioFile.h"
+#include "dr_wav.h"
+#include "mapped_file.hpp"
+#include "sample_loader.hpp"
+#include "sample_pool.hpp"
+#include "sample_encoding.hpp"
+#include "sample_audio_buffer.hpp"
+#include "sample_cache.hpp"
+#include "sample_bank.hpp"
+#include "resampler.hpp"
+#include "recording_arena.hpp"
+#include "waveform_overview.hpp"
+#include "onset_index.hpp"
+#include "zero_crossing_index.hpp"
 
-struct SampleAudioBuffer
+// How many frames the decoder converts at a time on its way into the
+// playback buffer
+#define SAMPLE_DECODE_CHUNK_FRAMES 4096
+
+// How many frames a SampleCursor fetches at a time
+#define SAMPLE_CURSOR_BLOCK_FRAMES 32
+
+//
+// SampleSwap is where the loader thread and the audio thread meet.  The loader
+// parks a handle to each freshly decoded buffer in 'pending'.  The audio
+// thread picks it up in Sample::poll() and leaves the handle that it replaced
+// in 'retired', where the loader's housekeeping releases it.  Neither side
+// ever waits on the other.
+//
+// Buffers are shared between modules through the SamplePool, so letting go of
+// a handle can free a buffer.  That's why the audio thread only ever moves
+// handles around and leaves the releasing to the loader.
+//
+// The loader only ever replaces 'pending' with another handle, never with
+// nullptr, so once the audio thread sees a pending handle it's guaranteed to
+// still be there when it goes to take it.
+//
+// Recorded takes don't go through the loader at all.  Housekeeping keeps an
+// empty buffer in 'spare', which Sample::start_take() wraps the take in and
+// swaps in on the audio thread.  See prepare_takes().
+//
+struct SampleSwap
 {
-  std::vector<float> left_buffer;
-	std::vector<float> right_buffer;
+  std::atomic<SampleAudioBufferHandle *> pending;
+  std::atomic<SampleAudioBufferHandle *> retired;
+  std::atomic<SampleAudioBufferHandle *> spare;
+
+  // 'generation' is bumped every time a load is requested, and 'completed'
+  // is set to the generation of the last job to finish.  Older jobs that
+  // are still in the queue see that they've been superseded and give up.
+  std::atomic<unsigned int> generation;
+  std::atomic<unsigned int> completed;
+
+  // The generation of the last take that start_take() swapped in
+  std::atomic<unsigned int> take_generation;
+
+  // Set when the Sample that owns this swap goes away
+  std::atomic<bool> cancelled;
+
+  // The overview of the last buffer to be published, for the UI thread.  It
+  // only ever changes on loader threads, and is read and written with
+  // std::atomic_load() and std::atomic_store(), so it's never released on
+  // the audio thread.
+  WaveformOverviewHandle overview;
+
+  // The memory used by the audio in the last buffer to be published, in
+  // bytes.  See SampleAudioBuffer::memory_size().
+  std::atomic<size_t> bytes;
+
+  std::mutex publish_mutex;
 
-  void clear()
+  SampleSwap() : pending(nullptr), retired(nullptr), spare(nullptr), generation(0), completed(0), take_generation(0), cancelled(false), bytes(0)
   {
-    left_buffer.resize(0);
-    right_buffer.resize(0);
   }
 
-  void push_back(float audio_left, float audio_right)
+  ~SampleSwap()
   {
-    left_buffer.push_back(audio_left);
-    right_buffer.push_back(audio_right);
+    delete pending.load();
+    delete retired.load();
+    delete spare.load();
   }
 
-  unsigned int size()
+  bool superseded(unsigned int job_generation)
   {
-    return(left_buffer.size());
+    return(cancelled || (generation != job_generation));
   }
 
-  std::pair<float, float> read(unsigned int index)
+  // Loader thread.  Publishes 'buffer' unless a newer load has been requested
+  // since the job started.  Jobs for the same Sample can finish in any order,
+  // so the check and the publish happen together under 'publish_mutex'.
+  // Only loader threads ever wait on the mutex.  The audio thread only tries
+  // it, in Sample::start_take().  If an older handle was never claimed by the
+  // audio thread, it's safe to throw it away.
+  bool publish(SampleAudioBufferHandle buffer, unsigned int job_generation)
+  {
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    if(superseded(job_generation)) return(false);
+
+    delete pending.exchange(new SampleAudioBufferHandle(buffer));
+    std::atomic_store(&overview, buffer->overview);
+    bytes = buffer->memory_size();
+    return(true);
+  }
+
+  // Loader thread.  Releases the retired handle.  Returns true once the audio
+  // thread has claimed the pending handle, meaning there's nothing left to
+  // collect.  The check comes first because the audio thread always retires
+  // the old handle before it clears 'pending'.
+  bool collect()
+  {
+    bool finished = (pending.load() == nullptr);
+    delete retired.exchange(nullptr);
+    return(finished);
+  }
+};
+
+//
+// The part of a file that a Sample loads, in seconds from the start of the
+// file.  An 'end' of 0 is the end of the file.  Only the frames in the region
+// are decoded, so memory and load time go with the length of the region
+// rather than the length of the file.
+//
+struct SampleRegion
+{
+  float start = 0;
+  float end = 0;
+
+  bool whole_file() const
+  {
+    return((start <= 0) && (end <= 0));
+  }
+
+  // Which of a file's 'total' frames at 'sample_rate' are in the region
+  void frames(unsigned int sample_rate, uint64_t total, uint64_t &first, uint64_t &count) const
+  {
+    first = std::min(total, (uint64_t) (std::max(0.0f, start) * (double) sample_rate));
+    uint64_t last = (end > 0) ? std::min(total, (uint64_t) (end * (double) sample_rate)) : total;
+    count = (last > first) ? (last - first) : 0;
+  }
+
+  // Keeps different regions of the same file apart in the pool and the cache
+  std::string key() const
+  {
+    return(rack::string::f("%g-%g", start, end));
+  }
+
+  bool operator==(const SampleRegion &other) const
   {
-    if((index >= left_buffer.size()) || (index >= right_buffer.size())) return {0.0, 0.0};
-    return {left_buffer[index], right_buffer[index]};
+    return((start == other.start) && (end == other.end));
   }
 };
 
+// Revisions are unique across every Sample, so that a SampleCursor can't
+// mistake one Sample for another that happens to be at the same address.
+inline unsigned int next_sample_revision()
+{
+  static std::atomic<unsigned int> counter(0);
+  return(++counter);
+}
+
 struct Sample
 {
 	std::string path;
 	std::string filename;
-	bool loading;
+	std::atomic<bool> loading;
   bool loaded = false;
   bool queued_for_loading = false;
   std::string queued_path = "";
   unsigned int sample_length = 0;
-  SampleAudioBuffer sample_audio_buffer;
+
+  // The audio that's playing.  This belongs to 'handle', which is shared
+  // with any other modules that loaded the same file.  Until something is
+  // loaded, it's an empty buffer.
+  const SampleAudioBuffer *sample_audio_buffer;
+  SampleAudioBufferHandle *handle = nullptr;
+
 	unsigned int sample_rate;
 	unsigned int channels;
-  AudioFile<float> audioFile; // For loading samples and saving samples
+
+  // Where recorded audio goes.  Recording into a Sample doesn't change what
+  // it plays.
+  RecordingArena recording;
+
+  std::shared_ptr<SampleSwap> swap;
+  std::shared_ptr<SampleLoader> loader;
+
+  // How the audio is stored in memory.  This takes effect on the next load().
+  SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32;
+
+  // The part of the file to load.  This takes effect on the next load().
+  // Use set_region() to change it and reload.
+  SampleRegion region;
+
+  // When this isn't -1, 'path' is a sample bank, and this is the entry in it
+  // to load.  Bank entries are played straight out of the bank file, so
+  // they're never resampled or re-encoded.  See SampleBank.
+  int bank_entry = -1;
+
+  // The rate that the audio is resampled to as it's loaded, which is normally
+  // the engine's.  When the two match, playback steps through the buffer one
+  // frame at a time.  0 leaves the audio at its own rate.
+  unsigned int target_sample_rate = 0;
+
+  // Changes whenever the audio moves or changes underneath any pointers that
+  // were handed out by read_block().  See SampleCursor.
+  unsigned int revision = next_sample_revision();
 
 	Sample()
 	{
-    sample_audio_buffer.clear();
+    sample_audio_buffer = empty_sample_audio_buffer();
 		loading = false;
 		filename = "[ empty ]";
 		path = "";
 		sample_rate = 0;
 		channels = 0;
 
-    audioFile.setNumChannels(2);
-    audioFile.setSampleRate(44100);
+    swap = std::make_shared<SampleSwap>();
+    loader = get_sample_loader();
 	}
 
+  // Samples can be moved, such as into a std::vector, but never copied.  A
+  // copy would either have to copy the audio or fight the original over the
+  // loader's handoff.  A move takes the audio, the handoff and any pending
+  // load along with it, and leaves the old Sample empty.  Neither Sample can
+  // be in use on the audio thread while it happens.
+  Sample(Sample &&other) :
+    path(std::move(other.path)),
+    filename(std::move(other.filename)),
+    loading(other.loading.load()),
+    loaded(other.loaded),
+    queued_for_loading(other.queued_for_loading),
+    queued_path(std::move(other.queued_path)),
+    sample_length(other.sample_length),
+    sample_audio_buffer(other.sample_audio_buffer),
+    handle(other.handle),
+    sample_rate(other.sample_rate),
+    channels(other.channels),
+    recording(std::move(other.recording)),
+    swap(std::move(other.swap)),
+    loader(std::move(other.loader)),
+    encoding(other.encoding),
+    region(other.region),
+    bank_entry(other.bank_entry),
+    target_sample_rate(other.target_sample_rate)
+  {
+    other.sample_audio_buffer = empty_sample_audio_buffer();
+    other.handle = nullptr;
+    other.sample_length = 0;
+    other.loaded = false;
+  }
+
+  Sample(const Sample &) = delete;
+  Sample &operator=(const Sample &) = delete;
+
   ~Sample()
   {
-    sample_audio_buffer.clear();
+    if(swap) swap->cancelled = true;
+    delete handle;
   }
 
+  //
+  // Queue the file at 'path' for loading.  This returns right away.  The new
+  // audio becomes audible once the module calls poll() after the loader has
+  // finished decoding it.  Until then, whatever was loaded before keeps
+  // playing.
+  //
   void load(std::string path)
+  {
+    // Store the file information up front so that the rest of the module,
+    // such as the context menus and dataToJson(), can refer to it right away.
+    this->filename = rack::string::filename(path);
+    this->path = path;
+
+    reload();
+  }
+
+  //
+  // Queue the file at 'path' for loading again, such as after unload().
+  // Unlike load(), this leaves the file information alone, so it's safe to
+  // call off of the UI thread while the UI is reading it.
+  //
+  void reload()
   {
     this->loading = true;
-    this->loaded = false;
 
-    float left = 0;
-    float right = 0;
+    std::shared_ptr<SampleSwap> swap = this->swap;
+    SampleLoader *loader = this->loader.get();
+    std::string path = this->path;
+    SampleEncoding encoding = this->encoding;
+    SampleRegion region = this->region;
+    int bank_entry = this->bank_entry;
+    unsigned int sample_rate = this->target_sample_rate;
+    unsigned int generation = ++swap->generation;
 
-    // If file fails to load, abandon operation
-    if(! audioFile.load(path))
+    loader->queue([swap, loader, path, encoding, region, bank_entry, sample_rate, generation]() {
+      if(swap->superseded(generation)) return;
+
+      // If another module already has this file loaded, this shares its
+      // buffer instead of decoding the file again.  Otherwise it comes from
+      // the disk cache when that's turned on and has it.  Bank entries are
+      // already decoded, so they skip the cache.
+      std::string format = std::to_string(encoding);
+      if(sample_rate != 0) format += "-" + std::to_string(sample_rate);
+      if(! region.whole_file()) format += "-region-" + region.key();
+      if(bank_entry >= 0) format = "bank-" + std::to_string(bank_entry);
+
+      SampleAudioBufferHandle buffer = get_sample_pool().acquire(path, format, [path, format, encoding, region, bank_entry, sample_rate]() {
+        if(bank_entry >= 0) return(SampleAudioBufferHandle(Sample::analyze(SampleBank::load(path, bank_entry))));
+
+        return(SampleAudioBufferHandle(Sample::analyze(get_sample_cache().load(path, format, [path, encoding, region, sample_rate]() {
+          if(sample_rate == 0) return(Sample::decode(path, encoding, region));
+          return(Sample::resample(Sample::decode(path, SAMPLE_ENCODING_FLOAT32, region), sample_rate, encoding));
+        }))));
+      });
+
+      if(buffer && swap->publish(buffer, generation))
+      {
+        loader->housekeeping([swap]() { return swap->collect(); });
+        Sample::analyze_onsets(loader, buffer);
+      }
+
+      if(swap->generation == generation) swap->completed = generation;
+    });
+	};
+
+  //
+  // Let go of the audio, but not the file information, so that the sample
+  // can be loaded again later with reload().  Like load(), this returns right
+  // away, and the sample goes quiet on the next poll().  The buffer itself is
+  // released by the loader, and freed if nothing else is sharing it.
+  //
+  void unload()
+  {
+    std::shared_ptr<SampleSwap> swap = this->swap;
+    SampleLoader *loader = this->loader.get();
+    unsigned int generation = ++swap->generation;
+
+    loader->queue([swap, loader, generation]() {
+      // The empty buffer is never freed
+      SampleAudioBufferHandle empty(empty_sample_audio_buffer(), [](const SampleAudioBuffer *) {});
+
+      if(swap->publish(empty, generation))
+      {
+        loader->housekeeping([swap]() { return swap->collect(); });
+      }
+
+      if(swap->generation == generation) swap->completed = generation;
+    });
+  }
+
+  //
+  // Not on the audio thread.  Has housekeeping keep an empty buffer ready for
+  // start_take(), and release the buffers that it retires.  Once a take has
+  // been swapped in, its overview and onsets are found on the loader, and a
+  // new spare is made.  Call this once, before the first take.
+  //
+  void prepare_takes()
+  {
+    std::shared_ptr<SampleSwap> swap = this->swap;
+    SampleLoader *loader = this->loader.get();
+
+    // The buffer in 'spare', which is the take's once start_take() has
+    // taken it
+    std::shared_ptr<SampleAudioBuffer> buffer;
+    unsigned int analyzed = 0;
+
+    loader->housekeeping([swap, loader, buffer, analyzed]() mutable {
+      if(swap->cancelled) return(true);
+
+      delete swap->retired.exchange(nullptr);
+
+      unsigned int take_generation = swap->take_generation.load(std::memory_order_acquire);
+
+      if(take_generation != analyzed)
+      {
+        analyzed = take_generation;
+
+        SampleAudioBufferHandle take(buffer);
+        buffer.reset();
+
+        loader->queue([swap, loader, take, take_generation]() {
+          WaveformOverviewHandle overview = WaveformOverview::build(take.get());
+
+          {
+            std::lock_guard<std::mutex> lock(swap->publish_mutex);
+            if(! swap->superseded(take_generation)) std::atomic_store(&swap->overview, overview);
+          }
+
+          Sample::analyze_onsets(loader, take);
+        });
+      }
+
+      if(buffer == nullptr)
+      {
+        buffer = std::make_shared<SampleAudioBuffer>();
+        swap->spare.store(new SampleAudioBufferHandle(buffer), std::memory_order_release);
+      }
+
+      return(false);
+    });
+  }
+
+  //
+  // Audio thread.  Start playing a recorded take right away.  Nothing is
+  // decoded, copied or allocated.  The take is wrapped in the spare buffer
+  // from prepare_takes(), which plays it out of the chunks it was recorded
+  // into, and is swapped in here instead of by poll().  Any load that's still
+  // in flight is superseded.
+  //
+  // Returns false if the take can't be swapped in yet, such as while the
+  // loader is publishing a buffer, or one is waiting for poll(), or the last
+  // one hasn't been released.  It can be tried again on a later frame.
+  //
+  // The take's path and filename are left to the caller to set, off of the
+  // audio thread.
+  //
+  bool start_take(const RecordedTake &take)
+  {
+    std::unique_lock<std::mutex> lock(swap->publish_mutex, std::try_to_lock);
+    if(! lock.owns_lock()) return(false);
+
+    if(swap->pending.load(std::memory_order_acquire) != nullptr) return(false);
+    if(swap->retired.load(std::memory_order_acquire) != nullptr) return(false);
+    if(swap->spare.load(std::memory_order_acquire) == nullptr) return(false);
+
+    // Nobody else has seen the spare buffer yet, so it can still be written to
+    SampleAudioBufferHandle *next = swap->spare.exchange(nullptr, std::memory_order_acq_rel);
+    SampleAudioBuffer *buffer = const_cast<SampleAudioBuffer *>(next->get());
+    buffer->wrap(take);
+
+    unsigned int generation = ++swap->generation;
+    swap->completed = generation;
+    swap->bytes = buffer->memory_size();
+
+    swap->retired.store(handle, std::memory_order_release);
+    handle = next;
+    sample_audio_buffer = buffer;
+    revision = next_sample_revision();
+
+    this->sample_length = buffer->size();
+    this->sample_rate = buffer->sample_rate;
+    this->channels = buffer->channels;
+    this->loaded = (this->sample_length > 0);
+    this->loading = false;
+
+    // Housekeeping finds the overview and the onsets once it sees this
+    swap->take_generation.store(generation, std::memory_order_release);
+    return(true);
+  }
+
+  // Decode 'region' of the file at 'path' into a new buffer.  This runs on
+  // the loader thread.  Returns nullptr if the file can't be loaded, or the
+  // region is empty.
+  //
+  // WAV files are decoded by dr_wav straight out of the memory-mapped file
+  // and into the playback buffer, a few thousand frames at a time, so the
+  // only full-size copy of the audio that ever exists is the one that gets
+  // played.  dr_wav seeks to the start of the region, so nothing before it
+  // is decoded, and only the pages of the file that hold the region are
+  // read.  dr_wav doesn't know about AIFF, so those still go through
+  // AudioFile.
+  static SampleAudioBuffer *decode(std::string path, SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32, SampleRegion region = SampleRegion())
+  {
+    MappedFile file;
+    if(! file.open(path)) return nullptr;
+
+    drwav wav;
+    if(! drwav_init_memory(&wav, file.data, file.size))
     {
-      this->loading = false;
-      this->loaded = false;
-      return;
+      file.close();
+      return(decode_with_audio_file(path, encoding, region));
     }
 
-    // Read details about the loaded sample
-    int sampleRate = audioFile.getSampleRate();
-    int numSamples = audioFile.getNumSamplesPerChannel();
-    int numChannels = audioFile.getNumChannels();
+    unsigned int channels = wav.channels;
+    drwav_uint64 number_of_frames = (channels > 0) ? (wav.totalSampleCount / channels) : 0;
+
+    // Don't let a bad header talk us into allocating more than the file
+    // could possibly hold.  This only works for uncompressed formats, where
+    // every frame takes up the same number of bytes.
+    if((wav.bytesPerSample > 0) && (wav.translatedFormatTag != DR_WAVE_FORMAT_ADPCM) && (wav.translatedFormatTag != DR_WAVE_FORMAT_DVI_ADPCM))
+    {
+      drwav_uint64 bytes_available = (wav.dataChunkDataPos < file.size) ? (file.size - wav.dataChunkDataPos) : 0;
+      number_of_frames = std::min(number_of_frames, bytes_available / (wav.bytesPerSample * channels));
+    }
 
-    this->channels = numChannels;
-    this->sample_rate = sampleRate;
-    sample_audio_buffer.clear();
+    uint64_t first_frame = 0;
+    uint64_t region_frames = 0;
+    region.frames(wav.sampleRate, number_of_frames, first_frame, region_frames);
+    number_of_frames = region_frames;
 
-    for (int i = 0; i < numSamples; i++)
+    // Frame indexes are unsigned ints everywhere else
+    number_of_frames = std::min(number_of_frames, (drwav_uint64) std::numeric_limits<unsigned int>::max());
+
+    SampleAudioBuffer *buffer = new SampleAudioBuffer();
+    buffer->sample_rate = wav.sampleRate;
+    buffer->reset(channels, encoding);
+
+    bool seeked = (first_frame == 0) || drwav_seek_to_sample(&wav, first_frame * channels);
+
+    if((number_of_frames == 0) || (! seeked) || (! buffer->resize((unsigned int) number_of_frames)))
+    {
+      drwav_uninit(&wav);
+      delete buffer;
+      return nullptr;
+    }
+
+    // Mono and stereo files are already laid out the way the buffer wants
+    // them, so when they're stored as float or 16-bit integers, dr_wav can
+    // convert them in place.  Otherwise the audio goes through a small
+    // scratch buffer on the way in.
+    bool in_place = (channels <= 2) && (encoding != SAMPLE_ENCODING_FLOAT16);
+
+    std::vector<float> interleaved;
+    if(! in_place) interleaved.resize(SAMPLE_DECODE_CHUNK_FRAMES * channels);
+
+    unsigned int frames_decoded = 0;
+
+    while(frames_decoded < number_of_frames)
     {
-      if(numChannels == 2)
+      unsigned int frames_to_read = std::min((unsigned int) SAMPLE_DECODE_CHUNK_FRAMES, (unsigned int) number_of_frames - frames_decoded);
+      size_t offset = (size_t) frames_decoded * buffer->channels;
+      unsigned int frames_read = 0;
+
+      if(in_place && (encoding == SAMPLE_ENCODING_INT16))
       {
-        left = audioFile.samples[0][i];  // [channel][sample_index]
-        right = audioFile.samples[1][i];
+        frames_read = drwav_read_s16(&wav, frames_to_read * channels, (int16_t *) buffer->data + offset) / channels;
       }
-      else if(numChannels == 1)
+      else if(in_place)
       {
-        left = audioFile.samples[0][i];
-        right = left;
+        frames_read = drwav_read_f32(&wav, frames_to_read * channels, buffer->frames() + offset) / channels;
+      }
+      else
+      {
+        frames_read = drwav_read_f32(&wav, frames_to_read * channels, interleaved.data()) / channels;
+
+        // Anything with more than two channels only keeps its first two
+        if(channels > 2)
+        {
+          for(unsigned int i = 0; i < frames_read; i++)
+          {
+            interleaved[(2 * i)] = interleaved[i * channels];
+            interleaved[(2 * i) + 1] = interleaved[(i * channels) + 1];
+          }
+        }
+
+        buffer->store(offset, interleaved.data(), (size_t) frames_read * buffer->channels);
       }
 
-      sample_audio_buffer.push_back(left, right);
+      if(frames_read == 0) break;
+      frames_decoded += frames_read;
     }
 
-    // Store sample length and file information to this object for the reset
-    // of the patch to reference.
-    this->sample_length = sample_audio_buffer.size();
-    this->filename = rack::string::filename(path);
-    this->path = path;
+    drwav_uninit(&wav);
 
-    this->loading = false;
-    this->loaded = true;
-	};
+    // The file ended early
+    buffer->frame_count = frames_decoded;
 
-  // Where to put recording code and how to save it?
-  void initialize_recording()
+    if(frames_decoded == 0)
+    {
+      delete buffer;
+      return nullptr;
+    }
+
+    return(buffer);
+  }
+
+  // Convert 'buffer', which has to hold float audio, to 'sample_rate' and
+  // 'encoding'.  This runs on the loader thread.  It takes ownership of
+  // 'buffer' and returns the buffer that replaces it, which is 'buffer' itself
+  // when there's nothing to do, or nullptr if memory runs out.
+  static SampleAudioBuffer *resample(SampleAudioBuffer *buffer, unsigned int sample_rate, SampleEncoding encoding)
   {
-    // Clear out audioFile data.  audioFile represents the .wav file information
-    // that can be loaded or saved.  In this case, we're going to be saving incoming audio pretty soon.
-    audioFile.samples[0].resize(0);
-    audioFile.samples[1].resize(0);
+    if(buffer == nullptr) return(nullptr);
+
+    bool same_rate = (sample_rate == 0) || (buffer->sample_rate == 0) || (buffer->sample_rate == sample_rate);
+    if(same_rate && (encoding == SAMPLE_ENCODING_FLOAT32)) return(buffer);
 
-    // Also clear out the sample audio information
-    sample_audio_buffer.clear();
-    sample_length = 0;
+    unsigned int channels = buffer->channels;
+    uint64_t number_of_frames = buffer->size();
+
+    SampleAudioBuffer *resampled = new SampleAudioBuffer();
+    resampled->reset(channels, encoding);
+
+    if(same_rate)
+    {
+      resampled->sample_rate = buffer->sample_rate;
+
+      if(resampled->resize(buffer->size())) resampled->store(0, buffer->frames(), number_of_frames * channels);
+    }
+    else
+    {
+      PolyphaseResampler resampler(buffer->sample_rate, sample_rate);
+      uint64_t resampled_frames = std::min(resampler.output_length(number_of_frames), (uint64_t) std::numeric_limits<unsigned int>::max());
+      resampled->sample_rate = sample_rate;
+
+      if(resampled->resize((unsigned int) resampled_frames))
+      {
+        std::vector<float> chunk(SAMPLE_DECODE_CHUNK_FRAMES * channels);
+
+        for(uint64_t first = 0; first < resampled_frames; first += SAMPLE_DECODE_CHUNK_FRAMES)
+        {
+          size_t count = (size_t) std::min((uint64_t) SAMPLE_DECODE_CHUNK_FRAMES, resampled_frames - first);
+          resampler.process(buffer->frames(), number_of_frames, channels, first, count, chunk.data());
+          resampled->store(first * channels, chunk.data(), count * channels);
+        }
+      }
+    }
+
+    delete buffer;
+
+    if(resampled->size() == 0)
+    {
+      delete resampled;
+      return(nullptr);
+    }
+
+    return(resampled);
   }
 
-  void record_audio(float left, float right)
+  // Work out everything about 'buffer' that's worth knowing ahead of time,
+  // such as the overview that its waveform is drawn from and where it crosses
+  // zero.  This runs on the loader thread, once per buffer, before the buffer
+  // is shared.  Returns 'buffer'.
+  static SampleAudioBuffer *analyze(SampleAudioBuffer *buffer)
   {
-    // Store incoming audio both in the audioFile for saving and in the sample for playback
-    audioFile.samples[0].push_back(left);
-    audioFile.samples[1].push_back(right);
+    if(buffer != nullptr)
+    {
+      buffer->overview = WaveformOverview::build(buffer);
+      buffer->crossings = ZeroCrossingIndex::build(buffer);
+    }
+    return(buffer);
+  }
+
+  // Find the onsets in 'buffer' in the background, after it's been published,
+  // so that a long sample doesn't take any longer to become playable.  A
+  // buffer that's shared by several Samples is only analyzed once.
+  static void analyze_onsets(SampleLoader *loader, SampleAudioBufferHandle buffer)
+  {
+    if(buffer->onsets_requested.exchange(true)) return;
 
-    sample_audio_buffer.push_back(left, right);
-    sample_length = sample_audio_buffer.size();
+    loader->queue([buffer]() {
+      buffer->set_onsets(OnsetIndex::build(buffer.get()));
+    });
   }
 
-  void save_recorded_audio(std::string path)
+  // Fallback for the file types that dr_wav can't read.  The AudioFile, and
+  // with it the extra copy of the audio, is gone by the time this returns.
+  // AudioFile always reads the whole file, so a region saves memory once the
+  // load is done, but not while it's happening.
+  static SampleAudioBuffer *decode_with_audio_file(std::string path, SampleEncoding encoding, SampleRegion region = SampleRegion())
   {
-    if(audioFile.save(path) != true)
+    AudioFile<float> audio_file;
+
+    // If file fails to load, abandon operation
+    if(! audio_file.load(path)) return nullptr;
+
+    // Read details about the loaded sample
+    int numSamples = audio_file.getNumSamplesPerChannel();
+    int numChannels = audio_file.getNumChannels();
+
+    // Only the region is kept
+    uint64_t first_frame = 0;
+    uint64_t region_frames = 0;
+    region.frames(audio_file.getSampleRate(), std::max(numSamples, 0), first_frame, region_frames);
+    numSamples = (int) region_frames;
+
+    SampleAudioBuffer *buffer = new SampleAudioBuffer();
+    buffer->sample_rate = audio_file.getSampleRate();
+    buffer->reset(numChannels, encoding);
+
+    if((numSamples <= 0) || (! buffer->resize(numSamples)))
+    {
+      delete buffer;
+      return nullptr;
+    }
+
+    if(buffer->channels == 1)
     {
-      // DEBUG(("Voxglitch sample.hpp::save_recorded_audio() - issue saving file to: " + path).c_str());
+      buffer->store(0, audio_file.samples[0].data() + first_frame, numSamples);
     }
+    else
+    {
+      std::vector<float> interleaved(SAMPLE_DECODE_CHUNK_FRAMES * 2);
+
+      for(int start = 0; start < numSamples; start += SAMPLE_DECODE_CHUNK_FRAMES)
+      {
+        int count = std::min(numSamples - start, SAMPLE_DECODE_CHUNK_FRAMES);
+
+        for(int i = 0; i < count; i++)
+        {
+          interleaved[(2 * i)] = audio_file.samples[0][first_frame + start + i];
+          interleaved[(2 * i) + 1] = audio_file.samples[1][first_frame + start + i];
+        }
+
+        buffer->store(2 * (size_t) start, interleaved.data(), 2 * (size_t) count);
+      }
+    }
+
+    return(buffer);
+  }
+
+  //
+  // Call this from process().  If the loader has a newly decoded buffer ready,
+  // swap it into place.  This never blocks and never allocates.  Returns true
+  // when a new buffer was swapped in.
+  //
+  bool poll()
+  {
+    loading = (swap->completed != swap->generation);
+
+    if(swap->pending.load(std::memory_order_acquire) == nullptr) return(false);
+
+    // Wait until the loader has freed the last buffer that was retired
+    if(swap->retired.load(std::memory_order_acquire) != nullptr) return(false);
+
+    swap->retired.store(handle, std::memory_order_release);
+    handle = swap->pending.exchange(nullptr, std::memory_order_acq_rel);
+    sample_audio_buffer = handle->get();
+    revision = next_sample_revision();
+
+    // Store sample length and file information to this object for the rest
+    // of the patch to reference.
+    this->sample_length = sample_audio_buffer->size();
+    this->sample_rate = sample_audio_buffer->sample_rate;
+    this->channels = sample_audio_buffer->channels;
+    this->loaded = (this->sample_length > 0);
+
+    return(true);
+  }
+
+  // Load only 'region' of the file from now on.  A file that's already
+  // loaded is loaded again.  Bank entries are always loaded whole.
+  void set_region(SampleRegion region)
+  {
+    if(region == this->region) return;
+    this->region = region;
+    if((path != "") && (bank_entry < 0)) reload();
+  }
+
+  // Resample to 'sample_rate' from now on.  A file that's already loaded is
+  // loaded again in the background, and keeps playing at its old rate until
+  // the new buffer is ready.  Bank entries are never resampled, so they're
+  // left as they are.
+  void set_target_sample_rate(unsigned int sample_rate)
+  {
+    if(sample_rate == target_sample_rate) return;
+    target_sample_rate = sample_rate;
+    if((path != "") && (bank_entry < 0)) reload();
+  }
+
+  // Any thread.  The size, in bytes, of the audio from the last load, even
+  // if poll() hasn't picked it up yet.  0 once the sample has been unloaded.
+  size_t memory_used()
+  {
+    return(swap->bytes);
+  }
+
+  // Returns true if a decoded buffer is waiting to be picked up by poll()
+  bool ready()
+  {
+    return(swap->pending.load(std::memory_order_acquire) != nullptr);
+  }
+
+  // Not on the audio thread.  Has to be called before recording, and again
+  // whenever the maximum length or the engine's sample rate changes.
+  void configure_recording(unsigned int maximum_frames, unsigned int sample_rate)
+  {
+    recording.configure(maximum_frames, sample_rate);
+  }
+
+  // Audio thread.  Starts a new recording, throwing out the last one.
+  void initialize_recording()
+  {
+    recording.reset();
+  }
+
+  // Audio thread.  This only ever writes into memory that's already there.
+  void record_audio(float left, float right)
+  {
+    recording.push(left, right);
+  }
+
+  // Audio thread.  Hands the recording to 'take' without copying it.  Use a
+  // SampleWriter to save it.
+  void finish_recording(RecordedTake &take)
+  {
+    recording.finish(take);
   }
 
   std::pair<float, float> read(unsigned int index)
   {
-    return(sample_audio_buffer.read(index));
+    return(sample_audio_buffer->read(index));
+  }
+
+  // Audio thread.  The onset in the audio that's playing that's closest to
+  // 'position'.  Until the onsets have been found, or if there aren't any,
+  // this is 'position' itself.
+  unsigned int nearest_onset(unsigned int position)
+  {
+    const OnsetIndex *onsets = sample_audio_buffer->onsets.load(std::memory_order_acquire);
+    return((onsets != nullptr) ? onsets->nearest(position) : position);
+  }
+
+  // Audio thread.  The zero crossing in the audio that's playing that's
+  // closest to 'position', or 'position' itself if there isn't one nearby.
+  // Jumping to a crossing means the audio starts from silence instead of
+  // with a click.
+  unsigned int nearest_zero_crossing(unsigned int position)
+  {
+    const ZeroCrossingIndex *crossings = sample_audio_buffer->crossings.get();
+    return((crossings != nullptr) ? crossings->nearest(position) : position);
+  }
+
+  // UI thread.  The overview of the audio that's playing, or about to be.
+  // It can change as soon as a load finishes, a moment before poll() swaps
+  // the audio in.  Returns nullptr until something has been loaded.
+  WaveformOverviewHandle overview()
+  {
+    return(std::atomic_load(&swap->overview));
+  }
+
+  // See SampleAudioBuffer::read_block().  The pointer is only good until the
+  // 'revision' changes.
+  const float *read_block(unsigned int index, unsigned int &count, float *scratch)
+  {
+    return(sample_audio_buffer->read_block(index, count, scratch));
   }
 
   unsigned int size()
@@ -156,3 +839,64 @@ struct Sample
   }
 
 };
+
+// Building a bank of samples must never copy their audio
+static_assert(! std::is_copy_constructible<Sample>::value, "Sample must not be copyable");
+static_assert(std::is_move_constructible<Sample>::value, "Sample must be movable");
+
+//
+// SampleCursor sits between a voice (a grain, ghost, goblin or player) and the
+// Sample that it's playing.  It keeps hold of a block of frames and serves
+// reads out of it, so the Sample only has to be asked, and the bounds only
+// checked, once every SAMPLE_CURSOR_BLOCK_FRAMES frames or so.  When the Sample
+// swaps in a new buffer, its revision changes and the cursor fetches a fresh
+// block.
+//
+// Samples that are stored in one of the 16-bit encodings get expanded into
+// the cursor's own 'expanded' array a block at a time.  Voices get copied
+// around, so the cursor remembers that it's using its own array rather than
+// keeping a pointer to it.
+//
+struct SampleCursor
+{
+  const float *block = nullptr;
+  bool block_expanded = false;
+  unsigned int block_start = 0;
+  unsigned int block_count = 0;
+  unsigned int block_channels = 2;
+  unsigned int revision = 0;
+  float expanded[SAMPLE_CURSOR_BLOCK_FRAMES * 2];
+
+  std::pair<float, float> read(Sample *sample, unsigned int index)
+  {
+    // Relies on unsigned wrap-around to also catch index < block_start
+    unsigned int offset = index - block_start;
+
+    if((offset >= block_count) || (revision != sample->revision))
+    {
+      // When playing backwards, fetch the block that ends at 'index' rather
+      // than the one that starts there.
+      bool reversing = (block != nullptr) && (index < block_start) && (revision == sample->revision);
+      unsigned int start = reversing ? (index - std::min(index, (unsigned int) SAMPLE_CURSOR_BLOCK_FRAMES - 1)) : index;
+
+      block_count = SAMPLE_CURSOR_BLOCK_FRAMES;
+      block = sample->read_block(start, block_count, expanded);
+      block_expanded = (block == expanded);
+      block_channels = sample->sample_audio_buffer->channels;
+      block_start = start;
+      revision = sample->revision;
+      offset = index - start;
+
+      if((block == nullptr) || (offset >= block_count)) return {0.0, 0.0};
+    }
+
+    const float *frames = block_expanded ? expanded : block;
+    return((block_channels == 1) ? read_sample_frame<1>(frames, offset) : read_sample_frame<2>(frames, offset));
+  }
+
+  void reset()
+  {
+    block = nullptr;
+    block_count = 0;
+  }
+};
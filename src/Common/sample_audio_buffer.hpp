@@ -0,0 +1,285 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include "aligned_memory.hpp"
+#include "mapped_file.hpp"
+#include "sample_encoding.hpp"
+#include "recording_arena.hpp"
+
+struct WaveformOverview;
+struct OnsetIndex;
+struct ZeroCrossingIndex;
+struct SampleBank;
+
+// Read one frame out of a block of frames that holds CHANNELS channels,
+// converting from whatever encoding it's stored in.  Mono frames come back on
+// both sides, so the fan-out from mono to stereo happens in registers instead
+// of in memory.
+template <unsigned int CHANNELS, typename T>
+inline std::pair<float, float> read_sample_frame(const T *frames, unsigned int index)
+{
+  if(CHANNELS == 1)
+  {
+    float audio = sample_to_float(frames[index]);
+    return {audio, audio};
+  }
+
+  const T *frame = frames + (2 * (size_t) index);
+  return {sample_to_float(frame[0]), sample_to_float(frame[1])};
+}
+
+//
+// SampleAudioBuffer holds decoded audio in a single cache-line aligned block.
+// Mono audio is stored as one channel.  Stereo audio is stored as interleaved
+// left/right frames, so reading a frame touches one cache line instead of
+// two separate vectors.  Either way, reads always come back as a left/right
+// pair of floats.
+//
+// The audio is normally stored as 32-bit floats, but can also be stored in
+// one of the 16-bit encodings in sample_encoding.hpp to save memory.
+//
+// A buffer that was read back from the SampleCache doesn't own its memory.
+// Its 'data' points into the cache file, which stays mapped for as long as
+// the buffer is around.  Those buffers are read-only.
+//
+// Buffers from a SampleBank are the same, except that every entry in the bank
+// shares the one mapping, which stays open until the last of them is gone.
+//
+// A buffer can also play a recorded take straight out of the chunks that it
+// was recorded into, without copying it.  Those have no 'data' at all, and
+// are read-only too.  See wrap().
+//
+struct SampleAudioBuffer
+{
+  uint8_t *data = nullptr;
+  unsigned int frame_count = 0;
+  size_t capacity = 0; // in bytes
+  unsigned int sample_rate = 0;
+
+  // The number of channels that are stored, which is either 1 or 2.  Files
+  // with more channels only keep their first two.
+  unsigned int channels = 2;
+
+  SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32;
+
+  // Set when 'data' lives in a mapped cache file rather than on the heap
+  MappedFile *mapping = nullptr;
+
+  // Set when 'data' lives in a mapped sample bank
+  std::shared_ptr<const SampleBank> bank;
+
+  // Set when the audio is a recorded take, which is always stereo float.
+  // Frame 'index' is at ('recording_start' + index) & 'recording_mask' in
+  // the take's chunks.  See RecordedTake.
+  RecordingChunksHandle recording;
+  unsigned int recording_start = 0;
+  unsigned int recording_mask = 0;
+
+  // Filled in by Sample::analyze() on the loader thread, before the buffer is
+  // shared with anyone.  Read-only after that.
+  std::shared_ptr<const WaveformOverview> overview;
+  std::shared_ptr<const ZeroCrossingIndex> crossings;
+
+  // Filled in by Sample::analyze_onsets() on the loader thread, after the
+  // buffer has been shared, because finding the onsets in a long sample can
+  // take a while.  Until then, 'onsets' is nullptr.  It only ever changes
+  // once, so the audio thread can read it at any time.  'onset_index' owns
+  // it.  See set_onsets().
+  mutable std::atomic<const OnsetIndex *> onsets;
+  mutable std::shared_ptr<const OnsetIndex> onset_index;
+  mutable std::atomic<bool> onsets_requested;
+
+  SampleAudioBuffer() : onsets(nullptr), onsets_requested(false)
+  {
+  }
+
+  ~SampleAudioBuffer()
+  {
+    if(mapping != nullptr) delete mapping;
+    else if(bank == nullptr) aligned_free(data);
+  }
+
+  SampleAudioBuffer(const SampleAudioBuffer &) = delete;
+  SampleAudioBuffer &operator=(const SampleAudioBuffer &) = delete;
+
+  // Loader thread.  Called once, by the job that Sample::analyze_onsets()
+  // queues.
+  void set_onsets(std::shared_ptr<const OnsetIndex> index) const
+  {
+    onset_index = index;
+    onsets.store(index.get(), std::memory_order_release);
+  }
+
+  void clear()
+  {
+    frame_count = 0;
+  }
+
+  // Empty the buffer and change how it stores audio
+  void reset(unsigned int channels, SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32)
+  {
+    frame_count = 0;
+    this->channels = (channels == 1) ? 1 : 2;
+    this->encoding = encoding;
+  }
+
+  size_t frame_size() const
+  {
+    return(channels * sample_encoding_size(encoding));
+  }
+
+  // The memory that the audio takes up, in bytes.  Audio that's mapped from
+  // a file doesn't count, since the operating system can page it back out
+  // whenever it needs to.
+  size_t memory_size() const
+  {
+    if((mapping != nullptr) || (bank != nullptr)) return(0);
+    return((size_t) frame_count * frame_size());
+  }
+
+  // Only meaningful when the encoding is SAMPLE_ENCODING_FLOAT32
+  float *frames() const
+  {
+    return((float *) data);
+  }
+
+  // Make room for at least 'frame_capacity' frames, keeping the existing
+  // audio.  Returns false if the memory couldn't be allocated.
+  bool reserve(unsigned int frame_capacity)
+  {
+    size_t required = (size_t) frame_capacity * frame_size();
+    if(required <= capacity) return(true);
+    if((mapping != nullptr) || recording) return(false);
+
+    uint8_t *expanded = (uint8_t *) aligned_malloc(required);
+    if(expanded == nullptr) return(false);
+
+    if(data != nullptr) std::memcpy(expanded, data, (size_t) frame_count * frame_size());
+    aligned_free(data);
+
+    data = expanded;
+    capacity = required;
+    return(true);
+  }
+
+  // Set the number of frames.  Any new frames are silent, which is all zero
+  // bits in every encoding.
+  bool resize(unsigned int count)
+  {
+    if(! reserve(count)) return(false);
+    if(count > frame_count) std::memset(data + ((size_t) frame_count * frame_size()), 0, (size_t) (count - frame_count) * frame_size());
+    frame_count = count;
+    return(true);
+  }
+
+  // Convert 'count' floats into the buffer's encoding, starting 'offset'
+  // values (not frames) into the buffer.  The room has to be there already.
+  void store(size_t offset, const float *values, size_t count)
+  {
+    switch(encoding)
+    {
+      case SAMPLE_ENCODING_INT16:
+        encode_int16(values, (int16_t *) data + offset, count);
+        break;
+      case SAMPLE_ENCODING_FLOAT16:
+        encode_float16(values, (HalfFloat *) data + offset, count);
+        break;
+      default:
+        std::copy(values, values + count, frames() + offset);
+    }
+  }
+
+  // Play 'take' in place.  The take's chunks are shared, not copied.
+  void wrap(const RecordedTake &take)
+  {
+    reset(2, SAMPLE_ENCODING_FLOAT32);
+    recording = take.audio;
+    recording_start = take.start;
+    recording_mask = take.mask;
+    frame_count = recording ? take.frame_count : 0;
+    sample_rate = take.sample_rate;
+  }
+
+  unsigned int size() const
+  {
+    return(frame_count);
+  }
+
+  std::pair<float, float> read(unsigned int index) const
+  {
+    if(index >= frame_count) return {0.0, 0.0};
+
+    if(recording)
+    {
+      const float *frame = recording->frame((recording_start + index) & recording_mask);
+      return {frame[0], frame[1]};
+    }
+
+    switch(encoding)
+    {
+      case SAMPLE_ENCODING_INT16: return(read_frame<int16_t>(index));
+      case SAMPLE_ENCODING_FLOAT16: return(read_frame<HalfFloat>(index));
+      default: return(read_frame<float>(index));
+    }
+  }
+
+  template <typename T>
+  std::pair<float, float> read_frame(unsigned int index) const
+  {
+    const T *values = (const T *) data;
+    return((channels == 1) ? read_sample_frame<1>(values, index) : read_sample_frame<2>(values, index));
+  }
+
+  // Returns a pointer to up to 'count' consecutive frames starting at 'index',
+  // as floats.  Each frame is 'channels' floats long.  'count' is trimmed to
+  // the number of frames that are actually there.  Returns nullptr, with
+  // 'count' set to 0, if 'index' is past the end of the buffer.
+  //
+  // Float audio is handed back in place.  The 16-bit encodings are expanded
+  // into 'scratch', which needs room for 'count' stereo frames, and so are
+  // blocks of a recorded take that straddle two of its chunks.
+  const float *read_block(unsigned int index, unsigned int &count, float *scratch) const
+  {
+    if(index >= frame_count)
+    {
+      count = 0;
+      return(nullptr);
+    }
+
+    count = std::min(count, frame_count - index);
+    size_t offset = (size_t) index * channels;
+
+    if(recording)
+    {
+      unsigned int position = (recording_start + index) & recording_mask;
+      if((position % RECORDING_ARENA_CHUNK_FRAMES) + count <= RECORDING_ARENA_CHUNK_FRAMES) return(recording->frame(position));
+
+      recording->copy(position, count, scratch, recording_mask);
+      return(scratch);
+    }
+
+    switch(encoding)
+    {
+      case SAMPLE_ENCODING_INT16:
+        expand_int16((const int16_t *) data + offset, scratch, (size_t) count * channels);
+        return(scratch);
+      case SAMPLE_ENCODING_FLOAT16:
+        expand_float16((const HalfFloat *) data + offset, scratch, (size_t) count * channels);
+        return(scratch);
+      default:
+        return(frames() + offset);
+    }
+  }
+};
+
+// Stands in for the audio of a Sample that hasn't loaded anything yet
+inline const SampleAudioBuffer *empty_sample_audio_buffer()
+{
+  static SampleAudioBuffer empty;
+  return(&empty);
+}
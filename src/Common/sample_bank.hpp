@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <limits>
+#include "mapped_file.hpp"
+#include "sample_audio_buffer.hpp"
+#include "sample_bank_format.hpp"
+#include "sample_pool.hpp"
+
+//
+// SampleBank is an open .vgbank file.  See sample_bank_format.hpp for the
+// layout, and tools/vgbank_builder.cpp for how to make one.
+//
+// Opening a bank maps the file and reads its directory, and that's all.  Each
+// entry's buffer points straight into the mapping, so there's nothing to
+// decode or copy, and the operating system pages the audio in as it's played.
+// The mapping is shared by every buffer from the same bank, and stays open
+// for as long as any of them are around.  Banks are told apart the same way
+// that the SamplePool tells files apart, so a bank that's rebuilt in place is
+// opened again rather than sharing the old mapping.
+//
+// Entries that don't check out, such as ones that claim to run past the end
+// of the file, are kept in the directory so that the rest keep their
+// positions, but they have no audio.
+//
+
+struct SampleBank
+{
+  MappedFile file;
+  std::vector<SampleBankEntry> entries;
+
+  // Returns the bank at 'path', or nullptr if it can't be opened or isn't a
+  // sample bank.  If the bank is already open, and hasn't changed on disk
+  // since, this shares its mapping.
+  static std::shared_ptr<const SampleBank> open(const std::string &path)
+  {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<const SampleBank>> banks;
+
+    std::string key;
+    if(! SamplePool::make_key(path, key)) return(nullptr);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(auto bank = banks.begin(); bank != banks.end();)
+    {
+      if(bank->second.expired()) bank = banks.erase(bank);
+      else ++bank;
+    }
+
+    auto found = banks.find(key);
+    if(found != banks.end()) return(found->second.lock());
+
+    std::shared_ptr<SampleBank> bank = std::make_shared<SampleBank>();
+    if(! bank->read(path)) return(nullptr);
+
+    banks[key] = bank;
+    return(bank);
+  }
+
+  // Loader thread.  A new buffer that plays entry 'index' of the bank at
+  // 'path' out of the mapping.  Returns nullptr if there's no such entry.
+  static SampleAudioBuffer *load(const std::string &path, unsigned int index)
+  {
+    std::shared_ptr<const SampleBank> bank = open(path);
+    if((bank == nullptr) || (index >= bank->size()) || (bank->entries[index].frame_count == 0)) return(nullptr);
+
+    const SampleBankEntry &entry = bank->entries[index];
+
+    SampleAudioBuffer *buffer = new SampleAudioBuffer();
+    buffer->reset(entry.channels, (SampleEncoding) entry.encoding);
+    buffer->sample_rate = entry.sample_rate;
+    buffer->frame_count = (unsigned int) entry.frame_count;
+    buffer->data = (uint8_t *) bank->file.data + entry.offset;
+    buffer->capacity = (size_t) entry.frame_count * buffer->frame_size();
+    buffer->bank = bank;
+
+    return(buffer);
+  }
+
+  bool read(const std::string &path)
+  {
+    if(! file.open(path, false)) return(false);
+
+    SampleBankHeader header;
+    if(file.size < sizeof(header)) return(false);
+    std::memcpy(&header, file.data, sizeof(header));
+
+    bool valid = (std::memcmp(header.magic, "VGBANK\0\0", sizeof(header.magic)) == 0) &&
+      (header.version == SAMPLE_BANK_VERSION) &&
+      (header.directory_offset >= sizeof(header)) &&
+      (header.directory_offset <= file.size) &&
+      (header.entry_count <= (file.size - header.directory_offset) / sizeof(SampleBankEntry));
+
+    if(! valid) return(false);
+
+    entries.resize(header.entry_count);
+    std::memcpy(entries.data(), file.data + header.directory_offset, entries.size() * sizeof(SampleBankEntry));
+
+    for(SampleBankEntry &entry : entries)
+    {
+      entry.name[SAMPLE_BANK_NAME_LENGTH - 1] = '\0';
+
+      bool entry_valid = ((entry.channels == 1) || (entry.channels == 2)) &&
+        (entry.encoding < NUMBER_OF_SAMPLE_ENCODINGS) &&
+        (entry.frame_count <= std::numeric_limits<unsigned int>::max()) &&
+        ((entry.offset % SAMPLE_BANK_ALIGNMENT) == 0) &&
+        (entry.offset <= file.size) &&
+        (entry.frame_count <= (file.size - entry.offset) / (entry.channels * sample_encoding_size(entry.encoding)));
+
+      if(! entry_valid) entry.frame_count = 0;
+    }
+
+    return(true);
+  }
+
+  size_t size() const
+  {
+    return(entries.size());
+  }
+
+  std::string name(unsigned int index) const
+  {
+    return((index < entries.size()) ? std::string(entries[index].name) : std::string());
+  }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+// Bump this whenever the layout of bank files changes
+#define SAMPLE_BANK_VERSION 1
+
+#define SAMPLE_BANK_EXTENSION "vgbank"
+
+// Every entry's audio starts on a multiple of this many bytes from the start
+// of the file, so that it's cache-line aligned once the file is mapped
+#define SAMPLE_BANK_ALIGNMENT 64
+
+// Room for each entry's name, including the terminating zero
+#define SAMPLE_BANK_NAME_LENGTH 96
+
+//
+// A sample bank (.vgbank) is a folder's worth of samples packed into a single
+// file, already decoded, so that a whole bank can be opened by mapping one
+// file instead of opening and decoding hundreds.  Wav Bank plays the entries
+// straight out of the mapping.
+//
+// The file starts with a SampleBankHeader, followed right away by the
+// directory: one SampleBankEntry for every sample.  After that comes each
+// entry's audio, interleaved, in the entry's encoding (see sample_encoding.hpp),
+// exactly as a SampleAudioBuffer holds it in memory.  Everything is little
+// endian.
+//
+// This file is shared with the builder in tools/, so it can't depend on
+// anything from Rack.
+//
+
+struct SampleBankHeader
+{
+  char magic[8];           // "VGBANK\0\0"
+  uint32_t version;
+  uint32_t entry_count;
+  uint64_t directory_offset;
+  uint8_t reserved[40];
+};
+
+static_assert(sizeof(SampleBankHeader) == 64, "SampleBankHeader must be 64 bytes");
+
+struct SampleBankEntry
+{
+  char name[SAMPLE_BANK_NAME_LENGTH]; // Usually the file it was built from
+  uint32_t channels;                  // 1 or 2
+  uint32_t encoding;                  // A SampleEncoding
+  uint32_t sample_rate;
+  uint32_t reserved;
+  uint64_t frame_count;
+  uint64_t offset;                    // From the start of the file
+};
+
+static_assert(sizeof(SampleBankEntry) == 128, "SampleBankEntry must be 128 bytes");
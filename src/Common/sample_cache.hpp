@@ -0,0 +1,458 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <cinttypes>
+#include "mapped_file.hpp"
+#include "file_system.hpp"
+#include "sample_audio_buffer.hpp"
+#include "sample_pool.hpp"
+
+// Bump this whenever the layout of the cache files changes, or the decoder
+// starts producing different audio, so that old entries are ignored
+#define SAMPLE_CACHE_VERSION 1
+
+// How much disk space the cache can take up before the entries that were used
+// least recently are thrown out.  This can be changed in the settings file.
+#define SAMPLE_CACHE_DEFAULT_MAXIMUM_MEGABYTES 1024
+
+#define SAMPLE_CACHE_EXTENSION "vgsample"
+
+// Pages are touched this far apart when a cache entry is read in
+#define SAMPLE_CACHE_PAGE_SIZE 4096
+
+//
+// SampleCache keeps decoded samples on disk so that they don't have to be
+// decoded again the next time Rack starts.  It's off unless it's turned on
+// from a module's context menu, and lives in the user folder under
+// voxglitch/cache.
+//
+// Each entry is a small header followed by the buffer's audio, exactly as it
+// sits in memory.  Loading an entry maps the file and hands the mapping to
+// the SampleAudioBuffer, so there's no decoding and no copying, only paging
+// in.
+//
+// Entries are named after a hash of the source file's contents and the format
+// that it was decoded to, such as the storage encoding.  Hashing a file means
+// reading all of it, so the index file remembers the hash of every file by
+// its path, modification time and size.  A file that changes on disk gets a
+// new index key, so it's hashed again and ends up with a new entry, and the
+// stale one eventually ages out.  Entries are evicted, least recently used
+// first, whenever the cache grows past its size limit.
+//
+
+struct SampleCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t channels;
+  uint32_t encoding;
+  uint32_t sample_rate;
+  uint64_t frame_count;
+  uint64_t content_hash;
+  uint8_t reserved[24];
+};
+
+// The audio that follows the header has to stay cache-line aligned
+static_assert(sizeof(SampleCacheHeader) == 64, "SampleCacheHeader must be 64 bytes");
+
+struct SampleCache
+{
+  std::mutex mutex;
+  std::string directory;
+  std::string settings_path;
+
+  // Source file index keys (see SamplePool::make_key) to content hashes
+  std::map<std::string, uint64_t> content_hashes;
+  bool index_loaded = false;
+
+  std::atomic<bool> enabled;
+  uint64_t maximum_size = (uint64_t) SAMPLE_CACHE_DEFAULT_MAXIMUM_MEGABYTES << 20;
+
+  SampleCache() : enabled(false)
+  {
+    directory = rack::asset::user("voxglitch/cache");
+    settings_path = rack::asset::user("voxglitch/sample_cache.json");
+    load_settings();
+  }
+
+  // Loader thread.  Returns the cached copy of the file at 'path' in the given
+  // 'format' if there is one.  Otherwise calls 'decode' and stores what it
+  // returns for next time.  Returns nullptr if decoding fails.
+  SampleAudioBuffer *load(const std::string &path, const std::string &format, std::function<SampleAudioBuffer *()> decode)
+  {
+    if(! enabled) return(decode());
+
+    std::string entry_path;
+    uint64_t content_hash = 0;
+    if(! find_entry(path, format, entry_path, content_hash)) return(decode());
+
+    SampleAudioBuffer *buffer = read_entry(entry_path, content_hash);
+
+    if(buffer != nullptr)
+    {
+      // The modification time doubles as the time it was last used
+      touch_file(entry_path);
+      return(buffer);
+    }
+
+    buffer = decode();
+    if((buffer != nullptr) && write_entry(entry_path, content_hash, *buffer)) evict();
+
+    return(buffer);
+  }
+
+  void set_enabled(bool enabled)
+  {
+    this->enabled = enabled;
+    save_settings();
+  }
+
+  //
+  // Entries
+  //
+
+  // Works out where the entry for 'path' in 'format' lives, hashing the file
+  // if it hasn't been seen before.  Returns false if the file can't be read.
+  bool find_entry(const std::string &path, const std::string &format, std::string &entry_path, uint64_t &content_hash)
+  {
+    std::string key;
+    if(! SamplePool::make_key(path, key)) return(false);
+
+    bool found = false;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      load_index();
+
+      auto hash = content_hashes.find(key);
+      if(hash != content_hashes.end())
+      {
+        content_hash = hash->second;
+        found = true;
+      }
+    }
+
+    if(! found)
+    {
+      if(! hash_file(path, content_hash)) return(false);
+
+      // Don't remember a hash for a file that changed while it was being read
+      std::string key_after;
+      if((! SamplePool::make_key(path, key_after)) || (key_after != key)) return(false);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      content_hashes[key] = content_hash;
+      append_index(key, content_hash);
+    }
+
+    char hash_text[17];
+    std::snprintf(hash_text, sizeof(hash_text), "%016" PRIx64, content_hash);
+
+    // Formats only ever hold simple text, but they end up in a filename
+    std::string safe_format = format;
+    for(char &character : safe_format)
+    {
+      if(! (isalnum((unsigned char) character) || (character == '-') || (character == '_'))) character = '_';
+    }
+
+    entry_path = directory + "/" + hash_text + "-" + safe_format + "." + SAMPLE_CACHE_EXTENSION;
+    return(true);
+  }
+
+  // Maps the entry at 'entry_path' and wraps it in a buffer.  Returns nullptr
+  // if there's no entry or it doesn't check out, in which case it's removed.
+  SampleAudioBuffer *read_entry(const std::string &entry_path, uint64_t content_hash)
+  {
+    MappedFile *file = new MappedFile();
+
+    if(! file->open(entry_path, false))
+    {
+      delete file;
+      return(nullptr);
+    }
+
+    SampleCacheHeader header;
+    bool valid = (file->size > sizeof(header));
+
+    if(valid)
+    {
+      std::memcpy(&header, file->data, sizeof(header));
+
+      valid = (std::memcmp(header.magic, "VGSAMPLE", sizeof(header.magic)) == 0) &&
+        (header.version == SAMPLE_CACHE_VERSION) &&
+        (header.content_hash == content_hash) &&
+        ((header.channels == 1) || (header.channels == 2)) &&
+        (header.encoding < NUMBER_OF_SAMPLE_ENCODINGS) &&
+        (header.frame_count > 0) &&
+        (header.frame_count <= std::numeric_limits<unsigned int>::max()) &&
+        ((file->size - sizeof(header)) == header.frame_count * header.channels * sample_encoding_size(header.encoding));
+    }
+
+    if(! valid)
+    {
+      delete file;
+      remove_file(entry_path);
+      return(nullptr);
+    }
+
+    // Page the audio in now, on the loader thread, rather than the first
+    // time that the audio thread plays through it
+    uint8_t total = 0;
+    for(size_t offset = sizeof(header); offset < file->size; offset += SAMPLE_CACHE_PAGE_SIZE) total += file->data[offset];
+    volatile uint8_t sink = total;
+    (void) sink;
+
+    SampleAudioBuffer *buffer = new SampleAudioBuffer();
+    buffer->reset(header.channels, (SampleEncoding) header.encoding);
+    buffer->sample_rate = header.sample_rate;
+    buffer->frame_count = (unsigned int) header.frame_count;
+    buffer->data = (uint8_t *) file->data + sizeof(header);
+    buffer->capacity = file->size - sizeof(header);
+    buffer->mapping = file;
+
+    return(buffer);
+  }
+
+  // Writes 'buffer' out as the entry at 'entry_path'.  The entry is written
+  // under a temporary name and then renamed, so a half-written entry is never
+  // picked up.
+  bool write_entry(const std::string &entry_path, uint64_t content_hash, const SampleAudioBuffer &buffer)
+  {
+    rack::system::createDirectory(rack::asset::user("voxglitch"));
+    rack::system::createDirectory(directory);
+
+    SampleCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "VGSAMPLE", sizeof(header.magic));
+    header.version = SAMPLE_CACHE_VERSION;
+    header.channels = buffer.channels;
+    header.encoding = buffer.encoding;
+    header.sample_rate = buffer.sample_rate;
+    header.frame_count = buffer.size();
+    header.content_hash = content_hash;
+
+    size_t audio_size = (size_t) buffer.size() * buffer.frame_size();
+    std::string partial_path = entry_path + ".partial";
+
+    FILE *file = open_file(partial_path, "wb");
+    if(file == NULL) return(false);
+
+    bool written = (std::fwrite(&header, sizeof(header), 1, file) == 1) && (std::fwrite(buffer.data, 1, audio_size, file) == audio_size);
+    written = (std::fclose(file) == 0) && written;
+
+    if((! written) || (! replace_file(partial_path, entry_path)))
+    {
+      remove_file(partial_path);
+      return(false);
+    }
+
+    return(true);
+  }
+
+  // Throws out the least recently used entries until the cache fits in
+  // 'maximum_size', then drops the index lines that no longer have entries.
+  void evict()
+  {
+    struct CacheEntry
+    {
+      std::string path;
+      int64_t size;
+      int64_t modification_time;
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<CacheEntry> entries;
+    uint64_t total_size = 0;
+
+    for(const std::string &path : rack::system::getEntries(directory))
+    {
+      CacheEntry entry;
+      entry.path = path;
+      if(rack::string::filenameExtension(path) != SAMPLE_CACHE_EXTENSION) continue;
+      if(! file_status(path, entry.size, entry.modification_time)) continue;
+      entries.push_back(entry);
+      total_size += entry.size;
+    }
+
+    if(total_size <= maximum_size) return;
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) {
+      return(a.modification_time < b.modification_time);
+    });
+
+    std::set<uint64_t> remaining_hashes;
+
+    for(const CacheEntry &entry : entries)
+    {
+      // Entries that are still mapped can't be removed on Windows
+      if((total_size > maximum_size) && remove_file(entry.path))
+      {
+        total_size -= entry.size;
+      }
+      else
+      {
+        remaining_hashes.insert(std::strtoull(rack::string::filename(entry.path).c_str(), NULL, 16));
+      }
+    }
+
+    for(auto hash = content_hashes.begin(); hash != content_hashes.end();)
+    {
+      if(remaining_hashes.count(hash->second)) ++hash;
+      else hash = content_hashes.erase(hash);
+    }
+
+    save_index();
+  }
+
+  //
+  // Index
+  //
+  // One line per source file: the content hash in hex, a space, then the
+  // index key.  New files are appended.  The whole thing is rewritten after
+  // an eviction.
+  //
+
+  std::string index_path()
+  {
+    return(directory + "/index.txt");
+  }
+
+  // Call with the mutex held
+  void load_index()
+  {
+    if(index_loaded) return;
+    index_loaded = true;
+
+    FILE *file = open_file(index_path(), "rb");
+    if(file == NULL) return;
+
+    std::string line;
+    int character;
+
+    while((character = std::fgetc(file)) != EOF)
+    {
+      if(character != '\n')
+      {
+        line += (char) character;
+        continue;
+      }
+
+      size_t space = line.find(' ');
+      if((space != std::string::npos) && (space > 0)) content_hashes[line.substr(space + 1)] = std::strtoull(line.substr(0, space).c_str(), NULL, 16);
+      line.clear();
+    }
+
+    std::fclose(file);
+  }
+
+  // Call with the mutex held
+  void append_index(const std::string &key, uint64_t content_hash)
+  {
+    rack::system::createDirectory(rack::asset::user("voxglitch"));
+    rack::system::createDirectory(directory);
+
+    FILE *file = open_file(index_path(), "ab");
+    if(file == NULL) return;
+    std::fprintf(file, "%016" PRIx64 " %s\n", content_hash, key.c_str());
+    std::fclose(file);
+  }
+
+  // Call with the mutex held
+  void save_index()
+  {
+    std::string partial_path = index_path() + ".partial";
+
+    FILE *file = open_file(partial_path, "wb");
+    if(file == NULL) return;
+
+    for(auto &hash : content_hashes)
+    {
+      std::fprintf(file, "%016" PRIx64 " %s\n", hash.second, hash.first.c_str());
+    }
+
+    if((std::fclose(file) != 0) || (! replace_file(partial_path, index_path()))) remove_file(partial_path);
+  }
+
+  //
+  // Settings
+  //
+
+  void load_settings()
+  {
+    FILE *file = open_file(settings_path, "rb");
+    if(file == NULL) return;
+
+    json_error_t error;
+    json_t *root = json_loadf(file, 0, &error);
+    std::fclose(file);
+    if(root == NULL) return;
+
+    json_t *enabled_json = json_object_get(root, "enabled");
+    if(enabled_json) enabled = json_is_true(enabled_json);
+
+    json_t *maximum_size_json = json_object_get(root, "maximum_size_mb");
+    if(maximum_size_json && (json_integer_value(maximum_size_json) > 0)) maximum_size = (uint64_t) json_integer_value(maximum_size_json) << 20;
+
+    json_decref(root);
+  }
+
+  void save_settings()
+  {
+    rack::system::createDirectory(rack::asset::user("voxglitch"));
+
+    json_t *root = json_object();
+    json_object_set_new(root, "enabled", json_boolean(enabled));
+    json_object_set_new(root, "maximum_size_mb", json_integer((json_int_t) (maximum_size >> 20)));
+
+    FILE *file = open_file(settings_path, "wb");
+    if(file != NULL)
+    {
+      json_dumpf(root, file, JSON_INDENT(2));
+      std::fclose(file);
+    }
+
+    json_decref(root);
+  }
+
+  //
+  // Files
+  //
+
+  // 64-bit FNV-1a over the whole file
+  static bool hash_file(const std::string &path, uint64_t &content_hash)
+  {
+    MappedFile file;
+    if(! file.open(path)) return(false);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(size_t i = 0; i < file.size; i++)
+    {
+      hash ^= file.data[i];
+      hash *= 0x100000001b3ULL;
+    }
+
+    content_hash = hash;
+    return(true);
+  }
+};
+
+inline SampleCache &get_sample_cache()
+{
+  static SampleCache cache;
+  return(cache);
+}
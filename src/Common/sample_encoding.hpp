@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+//
+// Samples can be kept in memory in a more compact form than 32-bit float.
+// 16-bit integer storage is lossless for 16-bit source files, which is most
+// of what people load.  16-bit float (half) storage keeps about 11 bits of
+// precision at every level, so quiet passages in 24-bit files come through
+// better than they would as integers.  Both halve the memory used.
+//
+// The functions in here convert between float and the compact encodings.  The
+// expand_*() functions are the ones that run on the audio thread, so they
+// have SSE2 versions that convert 8 values at a time.
+//
+
+enum SampleEncoding
+{
+  SAMPLE_ENCODING_FLOAT32 = 0,
+  SAMPLE_ENCODING_INT16 = 1,
+  SAMPLE_ENCODING_FLOAT16 = 2
+};
+
+#define NUMBER_OF_SAMPLE_ENCODINGS 3
+
+// A half-precision float, stored as raw bits.  It's a struct so that it can't
+// be confused with int16_t.
+struct HalfFloat
+{
+  uint16_t bits;
+};
+
+inline const char *sample_encoding_name(unsigned int encoding)
+{
+  switch(encoding)
+  {
+    case SAMPLE_ENCODING_INT16: return("16-bit integer (half the memory)");
+    case SAMPLE_ENCODING_FLOAT16: return("16-bit float (half the memory)");
+    default: return("32-bit float");
+  }
+}
+
+inline size_t sample_encoding_size(unsigned int encoding)
+{
+  return((encoding == SAMPLE_ENCODING_FLOAT32) ? sizeof(float) : sizeof(uint16_t));
+}
+
+inline uint32_t float_to_bits(float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return(bits);
+}
+
+inline float bits_to_float(uint32_t bits)
+{
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return(value);
+}
+
+//
+// Scalar conversions for single values
+//
+
+inline float sample_to_float(float value)
+{
+  return(value);
+}
+
+inline float sample_to_float(int16_t value)
+{
+  return(value * (1.0f / 32768.0f));
+}
+
+// Turns the half's exponent and mantissa into a float's by shifting them into
+// place and rescaling, which also takes care of denormals.  Infinity and NaN
+// need their exponent patched up afterwards.
+inline float sample_to_float(HalfFloat value)
+{
+  uint32_t exponent_and_mantissa = value.bits & 0x7fff;
+  uint32_t sign = (uint32_t) (value.bits & 0x8000) << 16;
+  uint32_t bits = float_to_bits(bits_to_float(exponent_and_mantissa << 13) * bits_to_float((254 - 15) << 23));
+  if(exponent_and_mantissa > 0x7bff) bits |= (255 << 23);
+  return(bits_to_float(bits | sign));
+}
+
+inline int16_t float_to_int16(float value)
+{
+  float scaled = value * 32768.0f;
+  scaled = std::max(-32768.0f, std::min(32767.0f, scaled));
+  return((int16_t) std::lrint(scaled));
+}
+
+// Rounds to nearest even, the same as hardware conversion would
+inline HalfFloat float_to_half(float value)
+{
+  const uint32_t float_infinity = 255 << 23;
+  const uint32_t half_maximum = (127 + 16) << 23;
+  const uint32_t denormal_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+  uint32_t bits = float_to_bits(value);
+  uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+
+  HalfFloat half;
+
+  if(bits >= half_maximum)
+  {
+    // Too big to represent becomes infinity, and NaN stays NaN
+    half.bits = (bits > float_infinity) ? 0x7e00 : 0x7c00;
+  }
+  else if(bits < (113 << 23))
+  {
+    // Small enough to be a denormal.  Adding the magic number lets the FPU
+    // do the rounding.
+    half.bits = (uint16_t) (float_to_bits(bits_to_float(bits) + bits_to_float(denormal_magic)) - denormal_magic);
+  }
+  else
+  {
+    uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += ((uint32_t) (15 - 127) << 23) + 0xfff;
+    bits += mantissa_odd;
+    half.bits = (uint16_t) (bits >> 13);
+  }
+
+  half.bits |= (uint16_t) (sign >> 16);
+  return(half);
+}
+
+//
+// Block conversions
+//
+
+inline void encode_int16(const float *source, int16_t *destination, size_t count)
+{
+  for(size_t i = 0; i < count; i++) destination[i] = float_to_int16(source[i]);
+}
+
+inline void encode_float16(const float *source, HalfFloat *destination, size_t count)
+{
+  for(size_t i = 0; i < count; i++) destination[i] = float_to_half(source[i]);
+}
+
+inline void expand_int16(const int16_t *source, float *destination, size_t count)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+  for(; i + 8 <= count; i += 8)
+  {
+    __m128i values = _mm_loadu_si128((const __m128i *) (source + i));
+
+    // Sign extend each 16-bit value to 32 bits by putting it in the top half
+    // of a 32-bit lane and shifting it back down.
+    __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+    __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+
+    _mm_storeu_ps(destination + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+    _mm_storeu_ps(destination + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+  }
+#endif
+
+  for(; i < count; i++) destination[i] = sample_to_float(source[i]);
+}
+
+#if defined(__SSE2__)
+// Four halves, one in the low 16 bits of each 32-bit lane, to four floats.
+// This is the same arithmetic as sample_to_float(HalfFloat).
+inline __m128 expand_float16_sse2(__m128i halves)
+{
+  const __m128i exponent_and_mantissa_mask = _mm_set1_epi32(0x7fff);
+  const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+  const __m128i largest_finite = _mm_set1_epi32(0x7bff);
+  const __m128 infinity_exponent = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+
+  __m128i exponent_and_mantissa = _mm_and_si128(halves, exponent_and_mantissa_mask);
+  __m128i sign = _mm_slli_epi32(_mm_xor_si128(halves, exponent_and_mantissa), 16);
+  __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exponent_and_mantissa, 13)), magic);
+  __m128 infinity_or_nan = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(exponent_and_mantissa, largest_finite)), infinity_exponent);
+
+  return(_mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(sign), infinity_or_nan)));
+}
+#endif
+
+inline void expand_float16(const HalfFloat *source, float *destination, size_t count)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+
+  for(; i + 8 <= count; i += 8)
+  {
+    __m128i values = _mm_loadu_si128((const __m128i *) (source + i));
+    _mm_storeu_ps(destination + i, expand_float16_sse2(_mm_unpacklo_epi16(values, zero)));
+    _mm_storeu_ps(destination + i + 4, expand_float16_sse2(_mm_unpackhi_epi16(values, zero)));
+  }
+#endif
+
+  for(; i < count; i++) destination[i] = sample_to_float(source[i]);
+}
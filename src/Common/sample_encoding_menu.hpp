@@ -0,0 +1,64 @@
+#pragma once
+
+#include "sample_encoding.hpp"
+#include "sample_cache.hpp"
+
+//
+// Adds the "Sample memory" options to a module's context menu.  The module
+// needs a 'sample_encoding' member and a set_sample_encoding() method that
+// reloads its samples with the new encoding.
+//
+// The disk cache setting is shared by every module, so it's the same
+// checkmark no matter which module's menu it's toggled from.
+//
+
+template <class MODULE>
+struct SampleEncodingMenuItem : MenuItem
+{
+  MODULE *module;
+  SampleEncoding encoding;
+
+  void onAction(const event::Action &e) override
+  {
+    module->set_sample_encoding(encoding);
+  }
+};
+
+struct SampleCacheMenuItem : MenuItem
+{
+  void onAction(const event::Action &e) override
+  {
+    SampleCache &cache = get_sample_cache();
+    cache.set_enabled(! cache.enabled);
+  }
+};
+
+template <class MODULE>
+void append_sample_encoding_menu(Menu *menu, MODULE *module)
+{
+  menu->addChild(new MenuEntry); // For spacing only
+  menu->addChild(createMenuLabel("Sample memory"));
+
+  for(unsigned int i = 0; i < NUMBER_OF_SAMPLE_ENCODINGS; i++)
+  {
+    SampleEncodingMenuItem<MODULE> *menu_item = createMenuItem<SampleEncodingMenuItem<MODULE>>(sample_encoding_name(i), CHECKMARK(module->sample_encoding == i));
+    menu_item->module = module;
+    menu_item->encoding = (SampleEncoding) i;
+    menu->addChild(menu_item);
+  }
+
+  menu->addChild(createMenuItem<SampleCacheMenuItem>("Cache decoded samples on disk", CHECKMARK(get_sample_cache().enabled)));
+}
+
+// Reads the encoding that was saved with the patch.  Anything unexpected falls
+// back to 32-bit float.
+inline SampleEncoding sample_encoding_from_json(json_t *root)
+{
+  json_t *encoding_json = json_object_get(root, "sample_encoding");
+  if(encoding_json == NULL) return(SAMPLE_ENCODING_FLOAT32);
+
+  json_int_t encoding = json_integer_value(encoding_json);
+  if((encoding < 0) || (encoding >= NUMBER_OF_SAMPLE_ENCODINGS)) return(SAMPLE_ENCODING_FLOAT32);
+
+  return((SampleEncoding) encoding);
+}
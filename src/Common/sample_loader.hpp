@@ -0,0 +1,158 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+// How often, in milliseconds, the loader wakes up to run housekeeping tasks
+#define SAMPLE_LOADER_HOUSEKEEPING_INTERVAL 50
+
+// The most decoding threads the loader will start, no matter how many cores
+// the computer has
+#define SAMPLE_LOADER_MAXIMUM_WORKERS 8
+
+//
+// SampleLoader is a plugin-wide pool of background workers that decode
+// samples off of the audio thread.  Sample::load() hands it a job and returns
+// immediately.  Modules pick up the finished buffer from within process() by
+// calling Sample::poll(), which never blocks or allocates.
+//
+// When a patch is opened, every module queues all of its samples at once, and
+// the workers decode them side by side.  Each Sample becomes playable as soon
+// as its own job finishes.  One core is left for the audio engine.
+//
+// The loader also runs "housekeeping" tasks on a thread of their own.  These
+// are small functions that are called every SAMPLE_LOADER_HOUSEKEEPING_INTERVAL
+// milliseconds until they return true.  Sample uses them to free buffers that
+// the audio thread has finished with.
+//
+// There's only ever one loader.  It's shared by every module that holds a
+// Sample, and it shuts down when the last of them is removed.  Use
+// get_sample_loader() to get at it.
+//
+
+struct SampleLoader
+{
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::condition_variable housekeeping_condition;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::function<bool()>> housekeeping_tasks;
+  bool running = true;
+
+  SampleLoader()
+  {
+    unsigned int cores = std::thread::hardware_concurrency();
+    unsigned int number_of_workers = std::max(2u, std::min((unsigned int) SAMPLE_LOADER_MAXIMUM_WORKERS, (cores > 1) ? (cores - 1) : 1));
+
+    for(unsigned int i = 0; i < number_of_workers; i++)
+    {
+      workers.push_back(std::thread(&SampleLoader::run_jobs, this));
+    }
+
+    workers.push_back(std::thread(&SampleLoader::run_housekeeping, this));
+  }
+
+  ~SampleLoader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    condition.notify_all();
+    housekeeping_condition.notify_all();
+
+    for(std::thread &worker : workers)
+    {
+      if(worker.joinable()) worker.join();
+    }
+  }
+
+  // Queue a job for the workers.  Jobs are started in the order that they
+  // were queued, but several can be running at once.
+  void queue(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+    condition.notify_one();
+  }
+
+  // Run 'task' on the housekeeping thread every
+  // SAMPLE_LOADER_HOUSEKEEPING_INTERVAL milliseconds until it returns true.
+  void housekeeping(std::function<bool()> task)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    housekeeping_tasks.push_back(std::move(task));
+  }
+
+  void run_jobs()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(running)
+    {
+      if(jobs.empty())
+      {
+        condition.wait(lock);
+        continue;
+      }
+
+      std::function<void()> job = std::move(jobs.front());
+      jobs.pop_front();
+
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+
+  // Housekeeping gets a thread of its own so that it never has to wait for a
+  // long decode to finish.
+  void run_housekeeping()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(running)
+    {
+      housekeeping_condition.wait_for(lock, std::chrono::milliseconds(SAMPLE_LOADER_HOUSEKEEPING_INTERVAL));
+      if(! running) break;
+
+      // Run the housekeeping tasks without holding the lock so that the
+      // tasks are free to queue more work.
+      std::vector<std::function<bool()>> tasks;
+      tasks.swap(housekeeping_tasks);
+
+      lock.unlock();
+      tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](std::function<bool()> &task) { return task(); }), tasks.end());
+      lock.lock();
+
+      housekeeping_tasks.insert(housekeeping_tasks.end(), tasks.begin(), tasks.end());
+    }
+  }
+};
+
+inline std::shared_ptr<SampleLoader> get_sample_loader()
+{
+  static std::mutex mutex;
+  static std::weak_ptr<SampleLoader> instance;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<SampleLoader> loader = instance.lock();
+
+  if(! loader)
+  {
+    loader = std::make_shared<SampleLoader>();
+    instance = loader;
+  }
+
+  return loader;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#endif
+
+struct SampleAudioBuffer;
+typedef std::shared_ptr<const SampleAudioBuffer> SampleAudioBufferHandle;
+
+//
+// SamplePool lets every module in the patch share a single decoded copy of
+// each file.  Buffers are looked up by the file's canonical path along with
+// its modification time and size, so editing a file on disk and reloading it
+// picks up the new version.
+//
+// The pool only keeps weak references.  A buffer lives for as long as some
+// Sample is holding a handle to it, and is freed when the last one lets go.
+//
+// If two modules ask for the same file at the same time, the second one waits
+// for the first to finish decoding rather than decoding it again.
+//
+
+struct SamplePool
+{
+  std::mutex mutex;
+  std::condition_variable decoded;
+  std::map<std::string, std::weak_ptr<const SampleAudioBuffer>> buffers;
+  std::set<std::string> decoding;
+
+  // Returns the buffer for the file at 'path', calling 'decode' to create it
+  // if nobody is holding it already.  'variant' tells apart buffers that were
+  // decoded from the same file in different ways, such as with different
+  // storage encodings.  Returns nullptr if the file doesn't exist or can't be
+  // decoded.
+  SampleAudioBufferHandle acquire(const std::string &path, const std::string &variant, std::function<SampleAudioBufferHandle()> decode)
+  {
+    std::string key;
+    if(! make_key(path, key)) return nullptr;
+    key += "|" + variant;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      while(decoding.count(key))
+      {
+        decoded.wait(lock);
+      }
+
+      auto found = buffers.find(key);
+      if(found != buffers.end())
+      {
+        SampleAudioBufferHandle buffer = found->second.lock();
+        if(buffer) return(buffer);
+      }
+
+      decoding.insert(key);
+    }
+
+    SampleAudioBufferHandle buffer = decode();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      decoding.erase(key);
+      purge();
+      if(buffer) buffers[key] = buffer;
+    }
+    decoded.notify_all();
+
+    return(buffer);
+  }
+
+  // Forget about buffers that have been freed.  Call with the mutex held.
+  void purge()
+  {
+    for(auto entry = buffers.begin(); entry != buffers.end();)
+    {
+      if(entry->second.expired()) entry = buffers.erase(entry);
+      else ++entry;
+    }
+  }
+
+  // The key is the canonical path plus the modification time and size
+  static bool make_key(const std::string &path, std::string &key)
+  {
+    std::string canonical_path;
+    int64_t modification_time = 0;
+    int64_t file_size = 0;
+
+#if defined(_WIN32)
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+    if(length <= 0) return(false);
+    std::wstring wide_path(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide_path[0], length);
+
+    struct _stat64 file_status;
+    if(_wstat64(wide_path.c_str(), &file_status) != 0) return(false);
+    modification_time = file_status.st_mtime;
+    file_size = file_status.st_size;
+
+    wchar_t full_path[MAX_PATH];
+    if(_wfullpath(full_path, wide_path.c_str(), MAX_PATH) == NULL) return(false);
+
+    // Windows paths aren't case sensitive
+    CharLowerW(full_path);
+
+    int utf8_length = WideCharToMultiByte(CP_UTF8, 0, full_path, -1, NULL, 0, NULL, NULL);
+    if(utf8_length <= 0) return(false);
+    canonical_path.resize(utf8_length);
+    WideCharToMultiByte(CP_UTF8, 0, full_path, -1, &canonical_path[0], utf8_length, NULL, NULL);
+    canonical_path.resize(utf8_length - 1);
+#else
+    struct stat file_status;
+    if(stat(path.c_str(), &file_status) != 0) return(false);
+    modification_time = file_status.st_mtime;
+    file_size = file_status.st_size;
+
+    char *resolved_path = realpath(path.c_str(), NULL);
+    if(resolved_path == NULL) return(false);
+    canonical_path = resolved_path;
+    free(resolved_path);
+#endif
+
+    key = canonical_path + "|" + std::to_string(modification_time) + "|" + std::to_string(file_size);
+    return(true);
+  }
+};
+
+inline SamplePool &get_sample_pool()
+{
+  static SamplePool pool;
+  return(pool);
+}
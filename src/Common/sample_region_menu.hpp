@@ -0,0 +1,107 @@
+#pragma once
+
+#include "sample.hpp"
+
+//
+// Adds a "Load region" submenu for a Sample to a module's context menu, so
+// that only part of a long recording is loaded.  The start and end are typed
+// in seconds, and take effect when Enter is pressed.  Changing the region
+// reloads the sample.
+//
+// sample_region_to_json() and sample_region_from_json() save and restore the
+// region with the patch.  The region has to be restored before the sample is
+// loaded, or the whole file gets loaded first.
+//
+
+struct SampleRegionField : TextField
+{
+  Sample *sample;
+  bool is_end = false;
+
+  SampleRegionField()
+  {
+    box.size.x = 120;
+  }
+
+  void onAction(const event::Action &e) override
+  {
+    SampleRegion region = sample->region;
+    float seconds = std::max(0.0f, (float) std::atof(text.c_str()));
+
+    if(is_end) region.end = seconds;
+    else region.start = seconds;
+
+    sample->set_region(region);
+  }
+};
+
+struct SampleWholeFileMenuItem : MenuItem
+{
+  Sample *sample;
+
+  void onAction(const event::Action &e) override
+  {
+    sample->set_region(SampleRegion());
+  }
+};
+
+struct SampleRegionMenuItem : MenuItem
+{
+  Sample *sample;
+
+  Menu *createChildMenu() override
+  {
+    Menu *menu = new Menu;
+
+    SampleWholeFileMenuItem *whole_file_menu_item = createMenuItem<SampleWholeFileMenuItem>("Whole file", CHECKMARK(sample->region.whole_file()));
+    whole_file_menu_item->sample = sample;
+    menu->addChild(whole_file_menu_item);
+
+    menu->addChild(createMenuLabel("Start (seconds)"));
+
+    SampleRegionField *start_field = new SampleRegionField;
+    start_field->sample = sample;
+    start_field->placeholder = "0";
+    if(sample->region.start > 0) start_field->text = rack::string::f("%g", sample->region.start);
+    menu->addChild(start_field);
+
+    menu->addChild(createMenuLabel("End (seconds)"));
+
+    SampleRegionField *end_field = new SampleRegionField;
+    end_field->sample = sample;
+    end_field->is_end = true;
+    end_field->placeholder = "End of file";
+    if(sample->region.end > 0) end_field->text = rack::string::f("%g", sample->region.end);
+    menu->addChild(end_field);
+
+    return(menu);
+  }
+};
+
+inline void append_sample_region_menu(Menu *menu, Sample *sample, std::string label)
+{
+  SampleRegionMenuItem *menu_item = createMenuItem<SampleRegionMenuItem>(label, RIGHT_ARROW);
+  menu_item->sample = sample;
+  menu->addChild(menu_item);
+}
+
+// Regions are saved per sample slot, numbered from 1 like the sample paths
+inline void sample_region_to_json(json_t *root, unsigned int slot, SampleRegion region)
+{
+  json_object_set_new(root, ("loaded_sample_region_start_" + std::to_string(slot)).c_str(), json_real(region.start));
+  json_object_set_new(root, ("loaded_sample_region_end_" + std::to_string(slot)).c_str(), json_real(region.end));
+}
+
+// Anything missing falls back to the whole file
+inline SampleRegion sample_region_from_json(json_t *root, unsigned int slot)
+{
+  SampleRegion region;
+
+  json_t *start_json = json_object_get(root, ("loaded_sample_region_start_" + std::to_string(slot)).c_str());
+  json_t *end_json = json_object_get(root, ("loaded_sample_region_end_" + std::to_string(slot)).c_str());
+
+  if(start_json) region.start = std::max(0.0f, (float) json_number_value(start_json));
+  if(end_json) region.end = std::max(0.0f, (float) json_number_value(end_json));
+
+  return(region);
+}
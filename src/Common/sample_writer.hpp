@@ -0,0 +1,192 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "file_system.hpp"
+#include "wav_writer.hpp"
+#include "recording_arena.hpp"
+
+// Most takes that can be waiting to be written at once.  Room for them is set
+// aside up front, so queueing a take never allocates.
+#define SAMPLE_WRITER_QUEUE_CAPACITY 32
+
+// How often, in milliseconds, the writer checks for takes when it hasn't been
+// woken up.  The audio thread can't notify a condition variable safely, so
+// this is how quickly a take starts being written.
+#define SAMPLE_WRITER_POLL_INTERVAL 10
+
+// Frames copied out of a take and written at a time
+#define SAMPLE_WRITER_BLOCK_FRAMES 16384
+
+//
+// Whoever queues a take keeps one of these and watches it to find out when
+// the file is safely on disk.  Takes are numbered by whoever queues them.
+//
+struct SampleWriterStatus
+{
+  std::atomic<unsigned int> saved_take;
+  std::atomic<unsigned int> failed_take;
+
+  SampleWriterStatus() : saved_take(0), failed_take(0)
+  {
+  }
+};
+
+struct SampleWriterJob
+{
+  RecordedTake take;
+  FixedPath path;
+  unsigned int take_number = 0;
+  std::shared_ptr<SampleWriterStatus> status;
+};
+
+//
+// SampleWriter saves recorded takes to .wav files on a thread of its own.
+// The audio thread only moves a finished take into the queue.  Each file is
+// written next to its destination, flushed all the way to the disk, and then
+// renamed into place, so the file at 'path' is either the previous one or the
+// complete new one, never something in between.
+//
+// The writer also runs tasks, such as RecordingStream's, every
+// SAMPLE_WRITER_POLL_INTERVAL milliseconds until they return true.
+//
+// Like the loader, there's only one writer, and it's shared.  Use
+// get_sample_writer() to get at it.  Takes that are still queued when the
+// last module lets go of it are written before it shuts down.
+//
+
+struct SampleWriter
+{
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<SampleWriterJob> jobs;
+  std::vector<std::function<bool()>> tasks;
+  bool running = true;
+
+  SampleWriter()
+  {
+    jobs.reserve(SAMPLE_WRITER_QUEUE_CAPACITY);
+    thread = std::thread(&SampleWriter::run, this);
+  }
+
+  ~SampleWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    condition.notify_all();
+
+    if(thread.joinable()) thread.join();
+  }
+
+  // Audio thread.  Moves 'job' into the queue without blocking or allocating.
+  // Returns false if the writer is busy with the queue or the queue is full,
+  // in which case 'job' is left alone and this can be tried again later.
+  bool try_queue(SampleWriterJob &job)
+  {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if((! lock.owns_lock()) || (jobs.size() >= SAMPLE_WRITER_QUEUE_CAPACITY)) return(false);
+
+    jobs.push_back(std::move(job));
+    return(true);
+  }
+
+  // Not on the audio thread.  Run 'task' on the writer thread every
+  // SAMPLE_WRITER_POLL_INTERVAL milliseconds until it returns true.
+  void add_task(std::function<bool()> task)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true)
+    {
+      if(jobs.empty())
+      {
+        // Run the tasks without holding the lock, so that the audio thread
+        // can queue takes in the meantime
+        std::vector<std::function<bool()>> running_tasks;
+        running_tasks.swap(tasks);
+
+        lock.unlock();
+        running_tasks.erase(std::remove_if(running_tasks.begin(), running_tasks.end(), [](std::function<bool()> &task) { return task(); }), running_tasks.end());
+        lock.lock();
+
+        tasks.insert(tasks.end(), running_tasks.begin(), running_tasks.end());
+
+        if(! running) break;
+        condition.wait_for(lock, std::chrono::milliseconds(SAMPLE_WRITER_POLL_INTERVAL));
+        continue;
+      }
+
+      SampleWriterJob job = std::move(jobs.front());
+      jobs.erase(jobs.begin());
+
+      lock.unlock();
+
+      bool saved = write(job.take, job.path.c_str());
+      if(job.status) (saved ? job.status->saved_take : job.status->failed_take).store(job.take_number, std::memory_order_release);
+
+      // The take's memory is released here, rather than on the audio thread
+      job.take.audio.reset();
+
+      lock.lock();
+    }
+  }
+
+  static bool write(const RecordedTake &take, const std::string &path)
+  {
+    if(! take.audio) return(false);
+
+    std::string partial_path = path + ".partial";
+    WavWriter writer;
+    bool written = writer.open(partial_path, 2, take.sample_rate);
+
+    std::vector<float> block((size_t) SAMPLE_WRITER_BLOCK_FRAMES * 2);
+
+    for(unsigned int start = 0; written && (start < take.frame_count); start += SAMPLE_WRITER_BLOCK_FRAMES)
+    {
+      unsigned int count = std::min((unsigned int) SAMPLE_WRITER_BLOCK_FRAMES, take.frame_count - start);
+      take.copy(start, count, block.data());
+      written = writer.write(block.data(), count);
+    }
+
+    written = writer.close() && written;
+    written = written && replace_file(partial_path, path);
+
+    if(! written) remove_file(partial_path);
+
+    return(written);
+  }
+};
+
+inline std::shared_ptr<SampleWriter> get_sample_writer()
+{
+  static std::mutex mutex;
+  static std::weak_ptr<SampleWriter> instance;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<SampleWriter> writer = instance.lock();
+
+  if(! writer)
+  {
+    writer = std::make_shared<SampleWriter>();
+    instance = writer;
+  }
+
+  return writer;
+}
@@ -1,5 +1,11 @@
 #define FADE_OUT_ACCUMULATOR 0.01f
 
+// When the first frame after a jump is within this much of the last one, such
+// as when the jump goes from one zero crossing to another, there's no click to
+// hide, and the smoothing ramp is skipped.  This is for audio that runs from
+// -1 to 1, so smooth before applying any gain.
+#define SMOOTH_SKIP_THRESHOLD 0.02f
+
 struct SmoothSubModule
 {
     float loop_smoothing_ramp = 0;
@@ -12,6 +18,11 @@ struct SmoothSubModule
 
     float process(float voltage, float smooth_rate)
     {
+        if((loop_smoothing_ramp == 0) && (std::fabs(voltage - previous_voltage) < SMOOTH_SKIP_THRESHOLD))
+        {
+            loop_smoothing_ramp = 1;
+        }
+
         if(loop_smoothing_ramp < 1)
         {
             loop_smoothing_ramp += smooth_rate;
@@ -46,6 +57,11 @@ struct StereoSmoothSubModule
 
     std::pair<float, float> process(float left_voltage, float right_voltage, float smooth_rate)
     {
+        if((smoothing_ramp == 0) && (std::fabs(left_voltage - left_previous_voltage) < SMOOTH_SKIP_THRESHOLD) && (std::fabs(right_voltage - right_previous_voltage) < SMOOTH_SKIP_THRESHOLD))
+        {
+            smoothing_ramp = 1;
+        }
+
         if(smoothing_ramp < 1)
         {
             smoothing_ramp += smooth_rate;
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "file_system.hpp"
+#include "sample_encoding.hpp"
+
+// Frames converted at a time on their way to the file
+#define WAV_WRITER_CHUNK_FRAMES 4096
+
+//
+// WavWriter writes 16-bit PCM .wav files a block at a time.  The header is
+// written up front with the sizes left at zero, and update_header() fills
+// them in for however much audio has been written so far.  That means the
+// file can be written as the audio comes in, and is a valid .wav file
+// whenever the header has just been updated.
+//
+// This does file I/O, so it never belongs on the audio thread.
+//
+
+struct WavWriter
+{
+  FILE *file = NULL;
+  unsigned int channels = 2;
+  unsigned int sample_rate = 44100;
+  uint64_t frames_written = 0;
+  std::vector<int16_t> converted;
+
+  ~WavWriter()
+  {
+    if(file != NULL) std::fclose(file);
+  }
+
+  bool open(const std::string &path, unsigned int channels, unsigned int sample_rate)
+  {
+    if(file != NULL) std::fclose(file);
+
+    this->channels = channels;
+    this->sample_rate = sample_rate;
+    this->frames_written = 0;
+
+    file = open_file(path, "wb");
+    if(file == NULL) return(false);
+
+    return(write_header());
+  }
+
+  // Append 'count' frames of interleaved float audio
+  bool write(const float *frames, size_t count)
+  {
+    if(file == NULL) return(false);
+
+    converted.resize(WAV_WRITER_CHUNK_FRAMES * channels);
+
+    for(size_t start = 0; start < count; start += WAV_WRITER_CHUNK_FRAMES)
+    {
+      size_t values = std::min((size_t) WAV_WRITER_CHUNK_FRAMES, count - start) * channels;
+      encode_int16(frames + (start * channels), converted.data(), values);
+
+      // .wav files are little endian, like every computer that Rack runs on
+      if(std::fwrite(converted.data(), sizeof(int16_t), values, file) != values) return(false);
+    }
+
+    frames_written += count;
+    return(true);
+  }
+
+  // Fill in the sizes in the header, then push everything out to the disk.
+  // Afterwards, the file holds everything that's been written so far, even
+  // if Rack crashes.
+  bool update_header()
+  {
+    if(file == NULL) return(false);
+
+    if(std::fseek(file, 0, SEEK_SET) != 0) return(false);
+
+    bool written = write_header();
+    written = (std::fseek(file, 0, SEEK_END) == 0) && written;
+
+    return(sync_file(file) && written);
+  }
+
+  bool close()
+  {
+    if(file == NULL) return(false);
+
+    bool written = update_header();
+    written = (std::fclose(file) == 0) && written;
+    file = NULL;
+
+    return(written);
+  }
+
+  bool write_header()
+  {
+    uint64_t data_size = frames_written * channels * sizeof(int16_t);
+
+    // Sizes past 4 GB can't be represented, so those files are left claiming
+    // to be as large as they can
+    uint32_t data_chunk_size = (uint32_t) std::min(data_size, (uint64_t) 0xffffffffu - 36);
+    uint32_t block_align = channels * sizeof(int16_t);
+
+    uint8_t header[44];
+    std::memcpy(header, "RIFF", 4);
+    put_uint32(header + 4, 36 + data_chunk_size);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    put_uint32(header + 16, 16);
+    put_uint16(header + 20, 1); // PCM
+    put_uint16(header + 22, channels);
+    put_uint32(header + 24, sample_rate);
+    put_uint32(header + 28, sample_rate * block_align);
+    put_uint16(header + 32, block_align);
+    put_uint16(header + 34, 16);
+    std::memcpy(header + 36, "data", 4);
+    put_uint32(header + 40, data_chunk_size);
+
+    return(std::fwrite(header, sizeof(header), 1, file) == 1);
+  }
+
+  // The most frames of 16-bit audio that a .wav file's sizes can describe
+  static uint64_t maximum_frames(unsigned int channels)
+  {
+    return((0xffffffffu - 36) / (channels * sizeof(int16_t)));
+  }
+
+  static void put_uint16(uint8_t *destination, uint32_t value)
+  {
+    destination[0] = value & 0xff;
+    destination[1] = (value >> 8) & 0xff;
+  }
+
+  static void put_uint32(uint8_t *destination, uint32_t value)
+  {
+    put_uint16(destination, value & 0xffff);
+    put_uint16(destination + 2, value >> 16);
+  }
+};
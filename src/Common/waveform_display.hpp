@@ -0,0 +1,55 @@
+#pragma once
+
+#include "waveform_overview.hpp"
+
+//
+// Draws the waveform of a module's sample from its WaveformOverview, one peak
+// per pixel column, so drawing costs the same however long the sample is.
+// The module needs a displayed_sample() method that returns the Sample to
+// show.
+//
+
+template <class MODULE>
+struct SampleWaveformDisplay : TransparentWidget
+{
+  MODULE *module = nullptr;
+
+  void draw(const DrawArgs &args) override
+  {
+    nvgSave(args.vg);
+
+    nvgBeginPath(args.vg);
+    nvgRoundedRect(args.vg, 0, 0, box.size.x, box.size.y, 2);
+    nvgFillColor(args.vg, nvgRGB(0x28, 0x28, 0x2a));
+    nvgFill(args.vg);
+
+    WaveformOverviewHandle overview;
+    if(module) overview = module->displayed_sample()->overview();
+
+    if(overview && (overview->frame_count > 0))
+    {
+      unsigned int columns = std::max(1, (int) box.size.x);
+      float middle = box.size.y / 2.0;
+      float scale = (middle - 1.0) / 32767.0;
+
+      nvgBeginPath(args.vg);
+
+      for(unsigned int column = 0; column < columns; column++)
+      {
+        unsigned int start = (unsigned int) (((uint64_t) overview->frame_count * column) / columns);
+        unsigned int end = (unsigned int) (((uint64_t) overview->frame_count * (column + 1)) / columns);
+        WaveformPeak peak = overview->peak(start, std::max(end, start + 1));
+
+        // At least a pixel tall, so that silence still shows up as a line
+        float top = middle - (peak.maximum * scale);
+        float height = std::max(1.0f, (peak.maximum - peak.minimum) * scale);
+        nvgRect(args.vg, column, top, 1, height);
+      }
+
+      nvgFillColor(args.vg, nvgRGBA(255, 255, 255, 0xb0));
+      nvgFill(args.vg);
+    }
+
+    nvgRestore(args.vg);
+  }
+};
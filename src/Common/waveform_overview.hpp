@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "sample_audio_buffer.hpp"
+
+// Frames summed up by each peak in the finest level of the pyramid
+#define WAVEFORM_OVERVIEW_BASE_FRAMES 64
+
+// Frames read out of the buffer at a time while the pyramid is being built
+#define WAVEFORM_OVERVIEW_BUILD_FRAMES 4096
+
+// The lowest and highest values over a stretch of audio, across both
+// channels, scaled so that -1.0 to 1.0 is -32767 to 32767
+struct WaveformPeak
+{
+  int16_t minimum;
+  int16_t maximum;
+};
+
+//
+// WaveformOverview is a min/max pyramid of a sample's audio, for drawing its
+// waveform.  Each peak in level 0 covers WAVEFORM_OVERVIEW_BASE_FRAMES frames,
+// and each level above that covers twice as many frames per peak as the one
+// below it, until the top level has a single peak for the whole sample.
+//
+// peak() answers from the level whose peaks are closest in size to the
+// stretch that it's asked about, so it looks at no more than a few peaks, no
+// matter how long the stretch or the sample is.  Drawing a waveform that's
+// N pixels wide costs N calls.
+//
+// The pyramid is built once, on the loader thread, and never changes after
+// that, so it can be read from any thread.  At 4 bytes for every 64 frames,
+// it's a small fraction of the size of the audio.
+//
+
+struct WaveformOverview
+{
+  unsigned int frame_count = 0;
+  std::vector<std::vector<WaveformPeak>> levels;
+
+  static std::shared_ptr<const WaveformOverview> build(const SampleAudioBuffer *buffer)
+  {
+    std::shared_ptr<WaveformOverview> overview = std::make_shared<WaveformOverview>();
+    overview->frame_count = buffer->size();
+    if(overview->frame_count == 0) return(overview);
+
+    std::vector<WaveformPeak> peaks(((size_t) overview->frame_count + WAVEFORM_OVERVIEW_BASE_FRAMES - 1) / WAVEFORM_OVERVIEW_BASE_FRAMES);
+    std::vector<float> scratch(WAVEFORM_OVERVIEW_BUILD_FRAMES * 2);
+    unsigned int channels = buffer->channels;
+
+    // Blocks always start on a peak boundary, so each peak is finished
+    // within a single block
+    for(unsigned int start = 0; start < overview->frame_count; start += WAVEFORM_OVERVIEW_BUILD_FRAMES)
+    {
+      unsigned int count = WAVEFORM_OVERVIEW_BUILD_FRAMES;
+      const float *block = buffer->read_block(start, count, scratch.data());
+      if(block == nullptr) break;
+
+      for(unsigned int first = 0; first < count; first += WAVEFORM_OVERVIEW_BASE_FRAMES)
+      {
+        const float *values = block + ((size_t) first * channels);
+        const float *end = values + ((size_t) std::min((unsigned int) WAVEFORM_OVERVIEW_BASE_FRAMES, count - first) * channels);
+
+        float minimum = *values;
+        float maximum = *values;
+
+        for(; values < end; values++)
+        {
+          minimum = std::min(minimum, *values);
+          maximum = std::max(maximum, *values);
+        }
+
+        peaks[(start + first) / WAVEFORM_OVERVIEW_BASE_FRAMES] = { scale(std::floor(minimum * 32767.0f)), scale(std::ceil(maximum * 32767.0f)) };
+      }
+    }
+
+    overview->levels.push_back(std::move(peaks));
+
+    while(overview->levels.back().size() > 1)
+    {
+      const std::vector<WaveformPeak> &below = overview->levels.back();
+      std::vector<WaveformPeak> level((below.size() + 1) / 2);
+
+      for(size_t i = 0; i < level.size(); i++)
+      {
+        const WaveformPeak &left = below[2 * i];
+        const WaveformPeak &right = below[std::min((2 * i) + 1, below.size() - 1)];
+        level[i] = { std::min(left.minimum, right.minimum), std::max(left.maximum, right.maximum) };
+      }
+
+      overview->levels.push_back(std::move(level));
+    }
+
+    return(overview);
+  }
+
+  static int16_t scale(float value)
+  {
+    return((int16_t) std::max(-32767.0f, std::min(32767.0f, value)));
+  }
+
+  // The peak across frames 'start' up to, but not including, 'end'.  The
+  // answer can take in a few frames on either side of the stretch, but never
+  // more than the stretch is long.
+  WaveformPeak peak(unsigned int start, unsigned int end) const
+  {
+    end = std::min(end, frame_count);
+    if((start >= end) || levels.empty()) return { 0, 0 };
+
+    // The coarsest level whose peaks are no longer than the stretch
+    unsigned int span = (end - start) / WAVEFORM_OVERVIEW_BASE_FRAMES;
+    unsigned int level = 0;
+    while(((span >> (level + 1)) > 0) && ((level + 1) < levels.size())) level++;
+
+    const std::vector<WaveformPeak> &peaks = levels[level];
+    uint64_t frames_per_peak = (uint64_t) WAVEFORM_OVERVIEW_BASE_FRAMES << level;
+
+    WaveformPeak result = peaks[start / frames_per_peak];
+
+    for(size_t index = (start / frames_per_peak) + 1; index <= ((end - 1) / frames_per_peak); index++)
+    {
+      result.minimum = std::min(result.minimum, peaks[index].minimum);
+      result.maximum = std::max(result.maximum, peaks[index].maximum);
+    }
+
+    return(result);
+  }
+};
+
+typedef std::shared_ptr<const WaveformOverview> WaveformOverviewHandle;
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "sample_audio_buffer.hpp"
+
+// Frames read out of the buffer at a time while the index is being built
+#define ZERO_CROSSING_INDEX_BUILD_FRAMES 4096
+
+// Only the first crossing in any stretch of this many frames is kept, which
+// caps the index at a small fraction of the size of the audio, even for noise
+#define ZERO_CROSSING_INDEX_MINIMUM_GAP 32
+
+// A crossing only counts if every channel is within this much of zero there.
+// In a stereo file, the two sides don't always cross together.
+#define ZERO_CROSSING_INDEX_THRESHOLD 0.01f
+
+// The furthest, in milliseconds, that a position is moved to land on a
+// crossing.  Positions with no crossing this close are left where they are.
+#define ZERO_CROSSING_INDEX_SNAP_DISTANCE 3
+
+//
+// ZeroCrossingIndex is a sorted list of the frames where a sample's audio
+// passes through zero.  When a module jumps to a new position, such as on a
+// retrigger or a loop wrap, moving the jump onto a crossing means that the
+// audio picks up from silence rather than part way up a wave.  A jump from
+// one crossing to another doesn't click, so the smoothing ramp that would
+// otherwise hide the click can be skipped.  See SmoothSubModule.
+//
+// The index is built on the loader thread before the sample is published,
+// and never changes after that.  nearest() is a binary search, so it's cheap
+// enough to call on the audio thread every time a module jumps.
+//
+
+struct ZeroCrossingIndex
+{
+  std::vector<unsigned int> positions;
+  unsigned int snap_distance = 0;
+
+  static std::shared_ptr<const ZeroCrossingIndex> build(const SampleAudioBuffer *buffer)
+  {
+    std::shared_ptr<ZeroCrossingIndex> index = std::make_shared<ZeroCrossingIndex>();
+    unsigned int sample_rate = (buffer->sample_rate > 0) ? buffer->sample_rate : 44100;
+    index->snap_distance = (unsigned int) (((uint64_t) sample_rate * ZERO_CROSSING_INDEX_SNAP_DISTANCE) / 1000);
+
+    std::vector<float> scratch(ZERO_CROSSING_INDEX_BUILD_FRAMES * 2);
+    unsigned int channels = buffer->channels;
+
+    float previous_sum = 0.0f;
+    float previous_peak = 0.0f;
+
+    for(unsigned int start = 0; start < buffer->size(); start += ZERO_CROSSING_INDEX_BUILD_FRAMES)
+    {
+      unsigned int count = ZERO_CROSSING_INDEX_BUILD_FRAMES;
+      const float *block = buffer->read_block(start, count, scratch.data());
+      if(block == nullptr) break;
+
+      for(unsigned int i = 0; i < count; i++)
+      {
+        const float *frame = block + ((size_t) i * channels);
+        float sum = (channels == 1) ? frame[0] : (frame[0] + frame[1]);
+        float peak = (channels == 1) ? std::fabs(frame[0]) : std::max(std::fabs(frame[0]), std::fabs(frame[1]));
+        unsigned int position = start + i;
+
+        // The crossing is between the last frame and this one.  Whichever
+        // of the two is closer to zero is the one that's kept.
+        if((position > 0) && ((sum >= 0.0f) != (previous_sum >= 0.0f)) && (std::min(peak, previous_peak) <= ZERO_CROSSING_INDEX_THRESHOLD))
+        {
+          unsigned int crossing = (peak <= previous_peak) ? position : (position - 1);
+
+          if(index->positions.empty() || (crossing >= index->positions.back() + ZERO_CROSSING_INDEX_MINIMUM_GAP))
+          {
+            index->positions.push_back(crossing);
+          }
+        }
+
+        previous_sum = sum;
+        previous_peak = peak;
+      }
+    }
+
+    index->positions.shrink_to_fit();
+    return(index);
+  }
+
+  // The crossing closest to 'position', or 'position' itself if there isn't
+  // one within the snap distance
+  unsigned int nearest(unsigned int position) const
+  {
+    std::vector<unsigned int>::const_iterator after = std::lower_bound(positions.begin(), positions.end(), position);
+    unsigned int closest = position;
+    unsigned int distance = snap_distance + 1;
+
+    if(after != positions.end())
+    {
+      closest = *after;
+      distance = *after - position;
+    }
+
+    if((after != positions.begin()) && ((position - *(after - 1)) < distance))
+    {
+      closest = *(after - 1);
+      distance = position - closest;
+    }
+
+    return((distance <= snap_distance) ? closest : position);
+  }
+
+  size_t size() const
+  {
+    return(positions.size());
+  }
+};
+
+typedef std::shared_ptr<const ZeroCrossingIndex> ZeroCrossingIndexHandle;
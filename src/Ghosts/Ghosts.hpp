@@ -10,6 +10,7 @@ struct Ghosts : Module
 
 	GhostsEx graveyard;
 	Sample sample;
+	SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
 	dsp::SchmittTrigger purge_trigger;
 	dsp::SchmittTrigger purge_button_trigger;
 
@@ -79,17 +80,24 @@ struct Ghosts : Module
 		configParam(JITTER_SWITCH, 0.f, 1.f, 1.f, "Jitter");
 
 		jitter_divisor = static_cast <float> (RAND_MAX / 1024.0);
+
+		// Samples are resampled to the engine's rate as they load
+		onSampleRateChange();
 	}
 
 	json_t *dataToJson() override
 	{
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "path", json_string(sample.path.c_str()));
+		json_object_set_new(rootJ, "sample_encoding", json_integer(sample_encoding));
+
 		return rootJ;
 	}
 
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
 		json_t *loaded_path_json = json_object_get(rootJ, ("path"));
 
 		if(loaded_path_json)
@@ -100,6 +108,29 @@ struct Ghosts : Module
 		}
 	}
 
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		sample.encoding = encoding;
+		if(reload && (sample.path != "")) sample.load(sample.path);
+	}
+
+	// The sample that the waveform display shows
+	Sample *displayed_sample()
+	{
+		return(&sample);
+	}
+
+	// Loaded samples are resampled again in the background whenever the engine's
+	// rate changes.  Until that finishes they keep playing at their old rate.
+	void onSampleRateChange() override
+	{
+		sample.set_target_sample_rate(APP->engine->getSampleRate());
+	}
+
 	float calculate_inputs(int input_index, int knob_index, int attenuator_index, float scale)
 	{
 		float input_value = inputs[input_index].getVoltage() / 10.0;
@@ -111,6 +142,9 @@ struct Ghosts : Module
 
 	void process(const ProcessArgs &args) override
 	{
+		// Pick up the sample once it has finished loading in the background
+		sample.poll();
+
 		float spawn_rate = calculate_inputs(GHOST_SPAWN_RATE_INPUT, GHOST_SPAWN_RATE_KNOB, GHOST_SPAWN_RATE_ATTN_KNOB, 4) + 1;
 		float playback_length = calculate_inputs(GHOST_PLAYBACK_LENGTH_INPUT, GHOST_PLAYBACK_LENGTH_KNOB, GHOST_PLAYBACK_LENGTH_ATTN_KNOB, (args.sampleRate / 16));
 		float start_position = calculate_inputs(SAMPLE_PLAYBACK_POSITION_INPUT, SAMPLE_PLAYBACK_POSITION_KNOB, SAMPLE_PLAYBACK_POSITION_ATTN_KNOB, sample.size());
@@ -14,6 +14,7 @@ struct Ghost
 
     // sample_ptr points to the loaded sample in memory
     Sample *sample_ptr;
+    SampleCursor cursor;
 
     // playback_position is similar to samplePos used in for samples.  However,
     // it's relative to the Ghost's start_position rather than the sample
@@ -48,7 +49,7 @@ struct Ghost
         // output_voltage_left  = this->sample_ptr->leftPlayBuffer[sample_position];
         // output_voltage_right = this->sample_ptr->rightPlayBuffer[sample_position];
 
-        std::tie(output_voltage_left, output_voltage_right) = this->sample_ptr->read((unsigned int) sample_position);
+        std::tie(output_voltage_left, output_voltage_right) = cursor.read(this->sample_ptr, (unsigned int) sample_position);
 
         // Smooth out transitions (or passthrough unmodified when not triggered)
         std::tie(output_voltage_left, output_voltage_right) = loop_smooth.process(output_voltage_left, output_voltage_right, smooth_rate);
@@ -138,6 +139,21 @@ struct GhostsEx
         // DEBUG(("counter: " + std::to_string(counter)).c_str());
         // counter++;
 
+        // Loop from one zero crossing to another where there are crossings
+        // close by, so that the loop wraps without a click and the smoothing
+        // can be skipped
+        if(start_position >= 0)
+        {
+            unsigned int loop_start = sample_ptr->nearest_zero_crossing(start_position);
+            unsigned int loop_end = sample_ptr->nearest_zero_crossing(start_position + playback_length);
+
+            if(loop_end > loop_start)
+            {
+                start_position = loop_start;
+                playback_length = loop_end - loop_start;
+            }
+        }
+
         // Configure it for playback
         ghost.start_position = start_position;
         ghost.playback_length = playback_length;
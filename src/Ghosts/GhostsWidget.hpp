@@ -54,6 +54,13 @@ struct GhostsWidget : ModuleWidget
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(64.746, 114.702)), module, Ghosts::AUDIO_OUTPUT_LEFT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(75.470, 114.702)), module, Ghosts::AUDIO_OUTPUT_RIGHT));
 		// addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(34.236, 124.893)), module, Ghosts::DEBUG_OUTPUT));
+
+		// Waveform
+		SampleWaveformDisplay<Ghosts> *waveform_display = new SampleWaveformDisplay<Ghosts>();
+		waveform_display->box.pos = mm2px(Vec(56.0, 58.0));
+		waveform_display->box.size = mm2px(Vec(26.0, 24.0));
+		waveform_display->module = module;
+		addChild(waveform_display);
 	}
 
 	void appendContextMenu(Menu *menu) override
@@ -68,6 +75,8 @@ struct GhostsWidget : ModuleWidget
 		menu_item_load_sample->text = module->loaded_filename;
 		menu_item_load_sample->module = module;
 		menu->addChild(menu_item_load_sample);
+
+		append_sample_encoding_menu(menu, module);
 	}
 
 };
@@ -6,6 +6,7 @@ struct Goblin
 
 	// sample_ptr points to the loaded sample in memory
 	Sample *sample_ptr;
+	SampleCursor cursor;
 
 	// playback_position is similar to samplePos used in for samples.  However,
 	// it's relative to the Goblin's start_position rather than the sample
@@ -24,7 +25,7 @@ struct Goblin
 		if (sample_position >= this->sample_ptr->size()) sample_position = sample_position % this->sample_ptr->size();
 
     float left; float right;
-    std::tie(left, right) = this->sample_ptr->read((unsigned int) sample_position);
+    std::tie(left, right) = cursor.read(this->sample_ptr, (unsigned int) sample_position);
 		return { left, right };
 	}
 
@@ -9,6 +9,7 @@ struct Goblins : Module
 
 	std::vector<Goblin> countryside;
 	Sample samples[NUMBER_OF_SAMPLES];
+	SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
 	std::string loaded_filenames[NUMBER_OF_SAMPLES] = {""};
 
 	dsp::SchmittTrigger purge_trigger;
@@ -72,6 +73,9 @@ struct Goblins : Module
 		configParam(PURGE_BUTTON_PARAM, 0.f, 1.f, 0.f, "PurgeButtonParam");
 
 		std::fill_n(loaded_filenames, NUMBER_OF_SAMPLES, "[ EMPTY ]");
+
+		// Samples are resampled to the engine's rate as they load
+		onSampleRateChange();
 	}
 
 	json_t *dataToJson() override
@@ -83,11 +87,15 @@ struct Goblins : Module
 			json_object_set_new(rootJ, ("loaded_sample_path_" + std::to_string(i+1)).c_str(), json_string(samples[i].path.c_str()));
 		}
 
+		json_object_set_new(rootJ, "sample_encoding", json_integer(sample_encoding));
+
 		return rootJ;
 	}
 
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
 		for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
 			json_t *loaded_sample_path = json_object_get(rootJ, ("loaded_sample_path_" +  std::to_string(i+1)).c_str());
@@ -99,6 +107,32 @@ struct Goblins : Module
 		}
 	}
 
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			samples[i].encoding = encoding;
+			if(reload && (samples[i].path != "")) samples[i].load(samples[i].path);
+		}
+	}
+
+	// The sample that the waveform display shows
+	Sample *displayed_sample()
+	{
+		return(&samples[selected_sample_slot]);
+	}
+
+	// Loaded samples are resampled again in the background whenever the engine's
+	// rate changes.  Until that finishes they keep playing at their old rate.
+	void onSampleRateChange() override
+	{
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) samples[i].set_target_sample_rate(APP->engine->getSampleRate());
+	}
+
 	float calculate_inputs(int input_index, int knob_index, int attenuator_index, float scale)
 	{
 		float input_value = inputs[input_index].getVoltage() / 10.0;
@@ -110,6 +144,9 @@ struct Goblins : Module
 
 	void process(const ProcessArgs &args) override
 	{
+		// Pick up any samples that have finished loading in the background
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) samples[i].poll();
+
 		//
 		//  Set selected sample based on inputs.
 		//  This must happen before we calculate start_position
@@ -155,7 +192,7 @@ struct Goblins : Module
             countryside.erase(countryside.begin());
 		}
 
-		if ((! selected_sample->loading) && (selected_sample->size() > 0))
+		if (selected_sample->size() > 0)
 		{
 			float left_mix_output = 0;
 			float right_mix_output = 0;
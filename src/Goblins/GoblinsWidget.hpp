@@ -54,6 +54,12 @@ struct GoblinsWidget : ModuleWidget
 		readout->box.size = Vec(200, 30); // bounding box of the widget
 		readout->module = module;
 		addChild(readout);
+
+		SampleWaveformDisplay<Goblins> *waveform_display = new SampleWaveformDisplay<Goblins>();
+		waveform_display->box.pos = mm2px(Vec(6.0, 67.4));
+		waveform_display->box.size = mm2px(Vec(90.0, 3.2));
+		waveform_display->module = module;
+		addChild(waveform_display);
 	}
 
 	void appendContextMenu(Menu *menu) override
@@ -76,5 +82,7 @@ struct GoblinsWidget : ModuleWidget
 			menu_item_load_sample->module = module;
 			menu->addChild(menu_item_load_sample);
 		}
+
+		append_sample_encoding_menu(menu, module);
 	}
 };
@@ -9,6 +9,7 @@ struct Grain
 
     // sample_ptr points to the loaded sample in memory
     Sample *sample_ptr;
+    SampleCursor cursor;
 
     // playback_position is similar to samplePos used in for samples.  However,
     // it's relative to the Ghost's start_position rather than the sample
@@ -54,7 +55,7 @@ struct Grain
             // output_voltage_left  = this->sample_ptr->leftPlayBuffer[sample_position];
             // output_voltage_right = this->sample_ptr->rightPlayBuffer[sample_position];
 
-            std::tie(output_voltage_left, output_voltage_right)  = this->sample_ptr->read(sample_position);
+            std::tie(output_voltage_left, output_voltage_right)  = cursor.read(this->sample_ptr, sample_position);
 
             // Apply amplitude slope
             int slope_index = (playback_position / playback_length) * 512.0;
@@ -10,6 +10,7 @@ struct GrainEngine : Module
 
 	GrainEngineEx grain_engine_core;
 	Sample sample;
+	SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
 	dsp::SchmittTrigger purge_trigger;
 	dsp::SchmittTrigger purge_button_trigger;
     dsp::SchmittTrigger spawn_trigger;
@@ -82,11 +83,15 @@ struct GrainEngine : Module
 	{
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "path", json_string(sample.path.c_str()));
+		json_object_set_new(rootJ, "sample_encoding", json_integer(sample_encoding));
+
 		return rootJ;
 	}
 
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
 		json_t *loaded_path_json = json_object_get(rootJ, ("path"));
 
 		if(loaded_path_json)
@@ -97,6 +102,16 @@ struct GrainEngine : Module
 		}
 	}
 
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		sample.encoding = encoding;
+		if(reload && (sample.path != "")) sample.load(sample.path);
+	}
+
 	float calculate_inputs(int input_index, int knob_index, int attenuator_index, float scale)
 	{
 		float input_value = inputs[input_index].getVoltage() / 10.0;
@@ -108,6 +123,9 @@ struct GrainEngine : Module
 
 	void process(const ProcessArgs &args) override
 	{
+		// Pick up the sample once it has finished loading in the background
+		sample.poll();
+
         float length_multiplier = params[LEN_MULT_KNOB].getValue();
 		float playback_length = calculate_inputs(LENGTH_INPUT, LENGTH_KNOB, LENGTH_ATTN_KNOB, 128) * length_multiplier;
 		float start_position = calculate_inputs(SAMPLE_PLAYBACK_POSITION_INPUT, SAMPLE_PLAYBACK_POSITION_KNOB, SAMPLE_PLAYBACK_POSITION_ATTN_KNOB, sample.size());
@@ -68,6 +68,8 @@ struct GrainEngineWidget : ModuleWidget
     menu_item_load_sample->text = module->loaded_filename;
     menu_item_load_sample->module = module;
     menu->addChild(menu_item_load_sample);
+
+    append_sample_encoding_menu(menu, module);
   }
 
 };
@@ -9,6 +9,9 @@
 #include "osdialog.h"
 #include "Common/common.hpp"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
+#include "Common/sample_region_menu.hpp"
+#include "Common/waveform_display.hpp"
 #include "Common/submodules.hpp"
 #include "Common/GrainEngineExpanderMessage.hpp"
 
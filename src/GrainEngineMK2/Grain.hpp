@@ -8,6 +8,7 @@ struct Grain
 
     // sample_ptr points to the loaded sample in memory
     Sample *sample_ptr;
+    SampleCursor cursor;
 
     // Eventually use inheritance to purge this sloppy pointer passing
     Common * common;
@@ -42,7 +43,7 @@ struct Grain
         sample_position = (this->start_position + this->playback_position);
         sample_position %= this->sample_ptr->size(); // be careful about division by 0 here
 
-        std::tie(output_voltage_left, output_voltage_right)  = this->sample_ptr->read(sample_position);
+        std::tie(output_voltage_left, output_voltage_right)  = cursor.read(this->sample_ptr, sample_position);
 
         // Apply amplitude slope
         int slope_index = (1.0 - ((float)age / (float)lifespan)) * 512.0;  // remember that age decrements instead of increments
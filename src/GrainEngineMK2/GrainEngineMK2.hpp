@@ -1,17 +1,63 @@
+//
+// LoadQueue keeps track of the sample slot that is being loaded in the
+// background.  Once the new sample has been decoded, the old one is faded out,
+// the new one is swapped in, and then faded in.
+//
 struct LoadQueue
 {
   bool sample_queued_for_loading = false;
-  std::string path_to_file = "";
-  std::string filename = "";
+  bool fading_out = false;
   unsigned int sample_number = 0;
 
-  void queue_sample_for_loading(std::string path_to_file, unsigned int sample_number)
+  void queue_sample_for_loading(unsigned int sample_number)
   {
     // DEBUG("queue_sample_for_loading called");
     this->sample_queued_for_loading = true;
-    this->path_to_file = path_to_file;
+    this->fading_out = false;
     this->sample_number = sample_number;
-    this->filename = filename;
+  }
+};
+
+//
+// SampleRequest hands a file to be loaded into one of the sample slots
+// between the audio thread and the UI thread, without locking or allocating.
+// Starting a load builds strings and takes the loader's lock, so it's never
+// done from process().
+//
+// The audio thread posts the files that the expander sends over.  The UI
+// thread starts loading them, along with the files picked from the menu, and
+// issues them back to the audio thread, which queues them in the LoadQueue so
+// that they're faded in once they're ready.  There's only ever one request at
+// a time, and whichever thread makes one claims it first.
+//
+// Recorded takes start playing on the audio thread, and only their path is
+// passed along, as a RECORDED request, so that the UI thread can name the
+// slot after it.
+//
+enum SampleRequestState {
+  SAMPLE_REQUEST_IDLE,
+  SAMPLE_REQUEST_CLAIMED,
+  SAMPLE_REQUEST_POSTED,
+  SAMPLE_REQUEST_ISSUED,
+  SAMPLE_REQUEST_RECORDED
+};
+
+struct SampleRequest
+{
+  std::atomic<int> state;
+  std::atomic<unsigned int> sample_slot;
+  FixedPath path;
+
+  SampleRequest() : state(SAMPLE_REQUEST_IDLE), sample_slot(0)
+  {
+  }
+
+  // Either thread.  Returns true if there was no request, in which case the
+  // caller owns it until it's posted or issued.
+  bool claim()
+  {
+    int idle = SAMPLE_REQUEST_IDLE;
+    return(state.compare_exchange_strong(idle, SAMPLE_REQUEST_CLAIMED, std::memory_order_acquire));
   }
 };
 
@@ -29,11 +75,29 @@ struct GrainEngineMK2 : Module
 	std::string path;
   float pan = 0;
   LoadQueue load_queue;
+  SampleRequest sample_request;
+
+  // Audio thread.  The take that the expander put into each slot, and the
+  // slot's revision once it was playing, so that a take is only named after
+  // its file if nothing else has been loaded into the slot since.
+  unsigned int take_numbers[NUMBER_OF_SAMPLES] = {};
+  unsigned int take_revisions[NUMBER_OF_SAMPLES] = {};
+
+  // UI thread.  The file that was last picked from the menu, until it can be
+  // issued.  A slot of -1 means there isn't one.
+  std::string requested_path = "";
+  int requested_sample_slot = -1;
+
   StereoFadeOutSubModule fade_out_on_load;
   StereoFadeInSubModule fade_in_after_load;
 
   // Structs
   Sample *samples[NUMBER_OF_SAMPLES];
+  SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
+
+  // When true, grains start from the onset closest to the position knob,
+  // before jitter and the fine and medium offsets are added
+  bool snap_to_onsets = false;
   Sample *selected_sample;
 
   Common common;
@@ -118,6 +182,7 @@ struct GrainEngineMK2 : Module
     for(unsigned int i=0; i<NUMBER_OF_SAMPLES; i++)
     {
       samples[i] = new Sample();
+      samples[i]->prepare_takes();
     }
 
     leftExpander.producerMessage = producer_message;
@@ -128,8 +193,8 @@ struct GrainEngineMK2 : Module
   {
     for(unsigned int i=0; i<NUMBER_OF_SAMPLES; i++)
     {
-      // delete samples[i];
-      // samples[i] = NULL;
+      delete samples[i];
+      samples[i] = NULL;
     }
   }
 
@@ -140,15 +205,26 @@ struct GrainEngineMK2 : Module
     for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
 			json_object_set_new(root, ("loaded_sample_path_" + std::to_string(i+1)).c_str(), json_string(samples[i]->path.c_str()));
+			sample_region_to_json(root, i+1, samples[i]->region);
 		}
 
+		json_object_set_new(root, "sample_encoding", json_integer(sample_encoding));
+		json_object_set_new(root, "snap_to_onsets", json_boolean(snap_to_onsets));
+
 		return root;
 	}
 
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
+		json_t *snap_to_onsets_json = json_object_get(rootJ, "snap_to_onsets");
+		if(snap_to_onsets_json) snap_to_onsets = json_is_true(snap_to_onsets_json);
+
     for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
+			samples[i]->region = sample_region_from_json(rootJ, i+1);
+
 			json_t *loaded_sample_path = json_object_get(rootJ, ("loaded_sample_path_" +  std::to_string(i+1)).c_str());
 			if (loaded_sample_path)
 			{
@@ -158,6 +234,25 @@ struct GrainEngineMK2 : Module
 		}
 	}
 
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			samples[i]->encoding = encoding;
+			if(reload && (samples[i]->path != "")) samples[i]->load(samples[i]->path);
+		}
+	}
+
+	// The sample that the waveform display shows
+	Sample *displayed_sample()
+	{
+		return(samples[selected_sample_slot]);
+	}
+
   float calculate_inputs(int input_index, int knob_index, int attenuator_index, float low_range, float high_range)
   {
     float output;
@@ -218,25 +313,53 @@ struct GrainEngineMK2 : Module
 
     this->processExpander();
 
-    if(load_queue.sample_queued_for_loading)
+    // Fade over to the sample that the UI thread has started loading
+    if(sample_request.state.load(std::memory_order_acquire) == SAMPLE_REQUEST_ISSUED)
     {
-      // If either there's no loaded sample in the sample slot, or the fade out
-      // of the existing sample has completed then load the new sample and start fading in.
-      if((fade_out_on_load.fading == false) || (samples[load_queue.sample_number]->loaded == false))
-      {
-        // dequeue the request.  We're going to process it right now!
-        load_queue.sample_queued_for_loading = false;
+      load_queue.queue_sample_for_loading(sample_request.sample_slot.load(std::memory_order_relaxed));
+      sample_request.state.store(SAMPLE_REQUEST_IDLE, std::memory_order_release);
+    }
 
-        // Load the sample!
-        // DEBUG(("GrainEngineMK2 loading file " + load_queue.path_to_file + " into slot " + std::to_string(load_queue.sample_number)).c_str());
-        samples[load_queue.sample_number]->load(load_queue.path_to_file);
-        std::string path = samples[load_queue.sample_number]->path;
+    // Pick up samples that have finished loading in the background, such as
+    // those loaded with the patch.  A slot that's being loaded for the load
+    // queue is left alone so that it can be faded out first.
+    for(unsigned int i=0; i<NUMBER_OF_SAMPLES; i++)
+    {
+      if(! awaiting_fade(i)) samples[i]->poll();
+    }
+
+    if(load_queue.sample_queued_for_loading)
+    {
+      Sample *queued_sample = samples[load_queue.sample_number];
 
-        this->root_dir = path; // This is used by the widget class
-        this->path = path;     // This is used by the widget class
-        loaded_filenames[load_queue.sample_number] = samples[load_queue.sample_number]->filename;
+      if(queued_sample->ready())
+      {
+        // If either there's no loaded sample in the sample slot, nothing is
+        // playing, or the fade out of the existing sample has completed, then
+        // swap in the new sample and start fading in.
+        bool silent = (queued_sample->loaded == false) || (selected_sample->loaded == false) || grain_engine_mk2_core.isEmpty();
 
-        fade_in_after_load.trigger();
+        if(silent || (load_queue.fading_out && (fade_out_on_load.fading == false)))
+        {
+          if(queued_sample->poll())
+          {
+            // dequeue the request.  We've processed it!
+            load_queue.sample_queued_for_loading = false;
+            fade_in_after_load.trigger();
+          }
+        }
+        else if(! load_queue.fading_out)
+        {
+          load_queue.fading_out = true;
+          fade_out_on_load.trigger();
+        }
+      }
+      else
+      {
+        // Nothing is waiting, so if the loader has finished the latest load
+        // anyway, it gave up on the file.  Don't poll here.  A buffer that
+        // turns up in the meantime would be swapped in without a fade.
+        if((queued_sample->swap->completed == queued_sample->swap->generation) && (! queued_sample->ready())) load_queue.sample_queued_for_loading = false;
       }
     }
 
@@ -304,6 +427,7 @@ struct GrainEngineMK2 : Module
     // start_position = common.rescaleWithPadding(start_position, 0.0, 1.0, 0.0, sample.size(), jitter_spread + MAX_POSITION_FINE, jitter_spread + MAX_POSITION_FINE + window_length);
 
     start_position = start_position * selected_sample->size();
+    if(snap_to_onsets) start_position = selected_sample->nearest_onset(start_position);
     start_position += (jitter + position_fine + position_medium);
 
     // Process Pan input
@@ -359,6 +483,132 @@ struct GrainEngineMK2 : Module
     if(spawn_throttling_countdown > 0) spawn_throttling_countdown--;
   }
 
+  // UI thread.  Load a sample in the background.  process() fades out the
+  // old sample and swaps in the new one once it's ready.
+  void load_sample(std::string path, unsigned int sample_number)
+  {
+    requested_path = path;
+    requested_sample_slot = sample_number;
+
+    process_requests();
+  }
+
+  // UI thread, from the widget's step().  Starts loading whatever the
+  // expander or the menu has asked for, and issues it to process().
+  void process_requests()
+  {
+    int state = sample_request.state.load(std::memory_order_acquire);
+
+    if(state == SAMPLE_REQUEST_POSTED)
+    {
+      start_loading(sample_request.path.c_str(), sample_request.sample_slot.load(std::memory_order_relaxed));
+      sample_request.state.store(SAMPLE_REQUEST_ISSUED, std::memory_order_release);
+    }
+    else if(state == SAMPLE_REQUEST_RECORDED)
+    {
+      // The take is already playing.  Its path is what gets loaded again
+      // when the encoding changes, or when the patch is reopened.  It's
+      // empty until the expander has saved the take.
+      unsigned int sample_number = sample_request.sample_slot.load(std::memory_order_relaxed);
+      Sample *sample = samples[sample_number];
+
+      sample->path = sample_request.path.c_str();
+      sample->filename = sample_request.path.empty() ? "[ recording ]" : rack::string::filename(sample->path);
+      loaded_filenames[sample_number] = sample->filename;
+
+      sample_request.state.store(SAMPLE_REQUEST_IDLE, std::memory_order_release);
+    }
+    else if((requested_sample_slot >= 0) && sample_request.claim())
+    {
+      // The slot goes in first, so that process() leaves it alone from the
+      // moment that it starts loading
+      sample_request.sample_slot.store(requested_sample_slot, std::memory_order_relaxed);
+      start_loading(requested_path, requested_sample_slot);
+      sample_request.state.store(SAMPLE_REQUEST_ISSUED, std::memory_order_release);
+
+      requested_sample_slot = -1;
+    }
+  }
+
+  void start_loading(std::string path, unsigned int sample_number)
+  {
+    samples[sample_number]->load(path);
+    loaded_filenames[sample_number] = samples[sample_number]->filename;
+
+    this->root_dir = path; // This is used by the widget class
+    this->path = path;     // This is used by the widget class
+  }
+
+  // Audio thread.  Hand a file from the expander to the UI thread to be
+  // loaded.  Returns false if there's already a request being handled.
+  bool post_sample_request(const FixedPath &path, unsigned int sample_number)
+  {
+    if(! sample_request.claim()) return(false);
+
+    sample_request.sample_slot.store(sample_number, std::memory_order_relaxed);
+    sample_request.path = path;
+    sample_request.state.store(SAMPLE_REQUEST_POSTED, std::memory_order_release);
+    return(true);
+  }
+
+  // Audio thread.  True while the sample in slot 'i' is being loaded for the
+  // load queue, which swaps it in itself.
+  bool awaiting_fade(unsigned int i)
+  {
+    if(load_queue.sample_queued_for_loading && (load_queue.sample_number == i)) return(true);
+    return((sample_request.state.load(std::memory_order_acquire) != SAMPLE_REQUEST_IDLE) && (sample_request.sample_slot.load(std::memory_order_relaxed) == i));
+  }
+
+  // Audio thread.  Start playing a take that the expander has just recorded.
+  // It's handed over as is, so there's nothing to decode, and it's faded in
+  // straight away.  Returns false if that can't be done yet.
+  bool start_take(const RecordedTake &take, unsigned int take_number, unsigned int sample_number)
+  {
+    if(! sample_request.claim()) return(false);
+
+    // A file that was on its way into the slot is superseded by the take.
+    // Leaving it to poll() also clears the way for the take if the file's
+    // buffer has already turned up.
+    if(load_queue.sample_queued_for_loading && (load_queue.sample_number == sample_number)) load_queue.sample_queued_for_loading = false;
+
+    if(! samples[sample_number]->start_take(take))
+    {
+      sample_request.state.store(SAMPLE_REQUEST_IDLE, std::memory_order_release);
+      return(false);
+    }
+
+    fade_in_after_load.trigger();
+
+    take_numbers[sample_number] = take_number;
+    take_revisions[sample_number] = samples[sample_number]->revision;
+
+    // The slot has no file until the take has been saved
+    sample_request.sample_slot.store(sample_number, std::memory_order_relaxed);
+    sample_request.path.clear();
+    sample_request.state.store(SAMPLE_REQUEST_RECORDED, std::memory_order_release);
+    return(true);
+  }
+
+  // Audio thread.  Have the UI thread name the slot after the file that the
+  // expander has saved take 'take_number' to, unless something else has been
+  // put into the slot since.  Returns false if that has to wait.
+  bool name_take(const FixedPath &path, unsigned int take_number, unsigned int sample_number)
+  {
+    if((take_numbers[sample_number] != take_number) || (take_revisions[sample_number] != samples[sample_number]->revision)) return(true);
+
+    // A file is on its way in, and the UI thread has already named the slot after it
+    if(load_queue.sample_queued_for_loading && (load_queue.sample_number == sample_number)) return(true);
+
+    if(! sample_request.claim()) return(false);
+
+    sample_request.sample_slot.store(sample_number, std::memory_order_relaxed);
+    sample_request.path = path;
+    sample_request.state.store(SAMPLE_REQUEST_RECORDED, std::memory_order_release);
+
+    take_numbers[sample_number] = 0;
+    return(true);
+  }
+
   void processExpander()
   {
     if (leftExpander.module && leftExpander.module->model == modelGrainEngineMK2Expander)
@@ -368,27 +618,33 @@ struct GrainEngineMK2 : Module
 
       if(expander_message->message_received == false)
       {
-        // Retrieve the path name
-        std::string filename = expander_message->filename;
-        std::string path = expander_message->path;
-
-        if(filename != "")
-        {
-          // Retrieve the sample slot
-          unsigned int sample_slot = expander_message->sample_slot;
-          sample_slot = clamp(sample_slot, 0, 4);
-
-          std::string path_to_file = path + "/" + filename;
+        // Retrieve the sample slot
+        unsigned int sample_slot = expander_message->sample_slot;
+        sample_slot = clamp(sample_slot, 0, 4);
 
-          // Queue sample for loading
-          load_queue.queue_sample_for_loading(path_to_file, sample_slot);
-          fade_out_on_load.trigger();
+        bool received = true;
 
-          // DEBUG(("Queued sample for loading: " + path_to_file).c_str());
+        if(expander_message->take.audio)
+        {
+          // Start granulating the recorded audio right away.  If it can't be
+          // swapped in yet, the message is picked up again on a later frame.
+          received = this->start_take(expander_message->take, expander_message->take_number, sample_slot);
+          if(received) expander_message->take = RecordedTake();
+        }
+        else if(expander_message->take_number != 0)
+        {
+          // The take has been saved, so the slot can be named after the file
+          received = this->name_take(expander_message->path, expander_message->take_number, sample_slot);
+        }
+        else if(! expander_message->path.empty())
+        {
+          // Queue sample for loading.  If the last one is still being handed
+          // over, the message is picked up again on a later frame.
+          received = this->post_sample_request(expander_message->path, sample_slot);
         }
 
         // Set the received flag so we don't process the message every single frame
-        expander_message->message_received = true;
+        expander_message->message_received = received;
       }
 
       leftExpander.messageFlipRequested = true;
@@ -10,8 +10,7 @@ struct GrainEngineMK2LoadSample : MenuItem
 
 		if(path)
 		{
-      module->load_queue.queue_sample_for_loading(std::string(path), sample_number);
-      module->fade_out_on_load.trigger();
+      module->load_sample(std::string(path), sample_number);
 
 			// module->samples[sample_number]->load(path);
 			// module->root_dir = std::string(path);
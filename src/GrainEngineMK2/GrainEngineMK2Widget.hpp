@@ -85,6 +85,23 @@ struct GrainEngineMK2Widget : ModuleWidget
     addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(vrule_b_5, hrule3)), module, GrainEngineMK2::SAMPLE_KNOB));
     addParam(createParamCentered<Trimpot>(mm2px(Vec(vrule_b_5, hrule4)), module, GrainEngineMK2::SAMPLE_ATTN_KNOB));
     addInput(createInputCentered<PJ301MPort>(mm2px(Vec(vrule_b_5, hrule5)), module, GrainEngineMK2::SAMPLE_INPUT));
+
+    // Waveform of the selected sample, between the position and spawn sections
+    SampleWaveformDisplay<GrainEngineMK2> *waveform_display = new SampleWaveformDisplay<GrainEngineMK2>();
+    waveform_display->box.pos = mm2px(Vec(3.0, 47.0));
+    waveform_display->box.size = mm2px(Vec(95.6, 4.5));
+    waveform_display->module = module;
+    addChild(waveform_display);
+  }
+
+  // Samples are only ever loaded from here or the menu, never from the
+  // audio thread
+  void step() override
+  {
+    GrainEngineMK2 *module = dynamic_cast<GrainEngineMK2*>(this->module);
+    if(module) module->process_requests();
+
+    ModuleWidget::step();
   }
 
   void appendContextMenu(Menu *menu) override
@@ -107,5 +124,29 @@ struct GrainEngineMK2Widget : ModuleWidget
 			menu_item_load_sample->module = module;
 			menu->addChild(menu_item_load_sample);
 		}
+
+    menu->addChild(new MenuEntry); // For spacing only
+    menu->addChild(createMenuLabel("Load regions"));
+
+		for(int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			append_sample_region_menu(menu, module->samples[i], std::to_string(i+1) + ": " + module->loaded_filenames[i]);
+		}
+
+    menu->addChild(new MenuEntry); // For spacing only
+    menu->addChild(createMenuLabel("Options"));
+
+    struct SnapToOnsetsMenuItem : MenuItem {
+      GrainEngineMK2 *module;
+      void onAction(const event::Action &e) override {
+        module->snap_to_onsets = !(module->snap_to_onsets);
+      }
+    };
+
+    SnapToOnsetsMenuItem *snap_to_onsets_menu_item = createMenuItem<SnapToOnsetsMenuItem>("Snap position to onsets", CHECKMARK(module->snap_to_onsets));
+    snap_to_onsets_menu_item->module = module;
+    menu->addChild(snap_to_onsets_menu_item);
+
+    append_sample_encoding_menu(menu, module);
   }
 };
@@ -7,6 +7,9 @@
 #include "osdialog.h"
 #include "Common/common.hpp"
 #include "Common/sample.hpp"
+#include "Common/sample_writer.hpp"
+#include "Common/capture_ring.hpp"
+#include "Common/recording_stream.hpp"
 #include "Common/GrainEngineExpanderMessage.hpp"
 
 #include "GrainEngineMK2Expander/defines.h"
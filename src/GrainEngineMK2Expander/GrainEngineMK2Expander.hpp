@@ -4,15 +4,71 @@ struct GrainEngineMK2Expander : Module
   dsp::SchmittTrigger record_stop_input_trigger;
   dsp::SchmittTrigger record_start_button_trigger;
   dsp::SchmittTrigger record_stop_button_trigger;
+  dsp::SchmittTrigger capture_input_trigger;
+  dsp::SchmittTrigger capture_button_trigger;
   std::string patch_uuid = "";
+  std::string recording_folder = "";
+
+  // Where takes for each sample slot are saved.  These are worked out ahead
+  // of time, so that sending a take only copies one.  See update_take_paths().
+  FixedPath take_paths[NUMBER_OF_SAMPLE_SLOTS];
   bool recording = false;
+  unsigned int maximum_recording_minutes = DEFAULT_MAXIMUM_RECORDING_MINUTES;
+  bool save_recordings = true;
+  bool stream_recordings = false;
+  unsigned int capture_seconds = DEFAULT_CAPTURE_SECONDS;
 
   Sample *sample = new Sample();
 
+  // Always recording, so that the last 'capture_seconds' of input can be
+  // sent to Grain Engine MK2 after the fact
+  CaptureRing capture_ring;
+
+  // Finished takes are handed to Grain Engine MK2 right away, and saved by
+  // the writer in the background.  'pending_job' holds a take until the
+  // writer has room for it.  Each slot has a status of its own, so that a
+  // save in one slot can't hide how another one went.  'saving_takes' holds
+  // the take that each slot is waiting to hear about, if any.
+  std::shared_ptr<SampleWriter> writer = get_sample_writer();
+  std::shared_ptr<SampleWriterStatus> save_statuses[NUMBER_OF_SAMPLE_SLOTS];
+  unsigned int saving_takes[NUMBER_OF_SAMPLE_SLOTS] = {};
+  SampleWriterJob pending_job;
+  bool job_pending = false;
+  unsigned int take_number = 0;
+
+  // Set when the last take that finished saving, or streaming, couldn't be
+  // written.  Shown in the context menu.
+  bool save_failed = false;
+
+  // Messages wait in 'outbox' until Grain Engine MK2 has picked up the last
+  // one, so that nothing it hasn't seen yet is ever written over.  A take
+  // that's stopped while the outbox is full stays in 'sample' until there's
+  // room, and a start that comes in meanwhile waits for it.
+  GrainEngineExpanderMessage outbox;
+  bool outbox_full = false;
+  bool take_waiting = false;
+  bool start_waiting = false;
+  unsigned int take_sample_slot = 0;
+
+  // Likewise for a capture, which is taken once there's room for it
+  bool capture_waiting = false;
+  unsigned int capture_sample_slot = 0;
+
+  // When streaming, takes go straight to disk instead, and Grain Engine MK2
+  // is told about the file once the writer has finished it
+  std::shared_ptr<SampleWriterStatus> stream_status = std::make_shared<SampleWriterStatus>();
+  std::shared_ptr<RecordingStream> stream;
+  bool streaming = false;
+  bool stream_notification_pending = false;
+  unsigned int stream_sample_slot = 0;
+  unsigned int stream_take_number = 0;
+  FixedPath stream_path;
+
   enum ParamIds {
     RECORD_START_BUTTON_PARAM,
     RECORD_STOP_BUTTON_PARAM,
     SAMPLE_SLOT_KNOB_PARAM,
+    CAPTURE_BUTTON_PARAM,
     NUM_PARAMS
   };
   enum InputIds {
@@ -21,6 +77,7 @@ struct GrainEngineMK2Expander : Module
     AUDIO_IN_LEFT,
     AUDIO_IN_RIGHT,
     SAMPLE_SLOT_INPUT,
+    CAPTURE_INPUT,
     NUM_INPUTS
   };
   enum OutputIds {
@@ -41,32 +98,54 @@ struct GrainEngineMK2Expander : Module
     configParam(RECORD_START_BUTTON_PARAM, 0.f, 1.f, 0.f, "RecordStartButtonParam");
     configParam(RECORD_STOP_BUTTON_PARAM, 0.f, 1.f, 0.f, "RecordEndButtonParam");
     configParam(SAMPLE_SLOT_KNOB_PARAM, 0.f, 4.f, 0.f, "SampleSlotKnobParam");
+    configParam(CAPTURE_BUTTON_PARAM, 0.f, 1.f, 0.f, "CaptureButtonParam");
 
     // Make sure that the folder where recorded audio is saved exists.  If not, create it.
-    std::string path = asset::user(WAV_FOLDER_NAME);
+    recording_folder = asset::user(WAV_FOLDER_NAME);
 
-    if(! system::isDirectory(path))
+    if(! system::isDirectory(recording_folder))
     {
-      system::createDirectory(path);
+      system::createDirectory(recording_folder);
       // DEBUG("creating path for sample storage");
-      // DEBUG(path.c_str());
+      // DEBUG(recording_folder.c_str());
     }
     else
     {
       // DEBUG("Using path: ");
-      // DEBUG(path.c_str());
+      // DEBUG(recording_folder.c_str());
     }
+
+    for(unsigned int i = 0; i < NUMBER_OF_SAMPLE_SLOTS; i++)
+    {
+      save_statuses[i] = std::make_shared<SampleWriterStatus>();
+    }
+
+    // A patch that's loaded replaces this with its own
+    patch_uuid = random_string(12);
+    update_take_paths();
+
+    // Set aside memory for recording before it's needed
+    configure_recording();
+
+    stream = std::make_shared<RecordingStream>(recording_folder, stream_status);
+    RecordingStream::attach(stream, writer);
   }
 
   // Destructor
   ~GrainEngineMK2Expander()
   {
+    stream->closed = true;
+    delete sample;
   }
 
   json_t *dataToJson() override
   {
     json_t *root = json_object();
     json_object_set_new(root, "patch_uuid", json_string(patch_uuid.c_str()));
+    json_object_set_new(root, "maximum_recording_minutes", json_integer(maximum_recording_minutes));
+    json_object_set_new(root, "save_recordings", json_boolean(save_recordings));
+    json_object_set_new(root, "stream_recordings", json_boolean(stream_recordings));
+    json_object_set_new(root, "capture_seconds", json_integer(capture_seconds));
     return root;
   }
 
@@ -76,6 +155,182 @@ struct GrainEngineMK2Expander : Module
     if (patch_uuid_json) patch_uuid = json_string_value(patch_uuid_json);
 
     if(patch_uuid == "") patch_uuid = random_string(12);
+    update_take_paths();
+
+    json_t* maximum_recording_minutes_json = json_object_get(root, "maximum_recording_minutes");
+    if (maximum_recording_minutes_json && (json_integer_value(maximum_recording_minutes_json) > 0))
+    {
+      maximum_recording_minutes = json_integer_value(maximum_recording_minutes_json);
+      configure_recording();
+    }
+
+    json_t* save_recordings_json = json_object_get(root, "save_recordings");
+    if (save_recordings_json) save_recordings = json_boolean_value(save_recordings_json);
+
+    json_t* stream_recordings_json = json_object_get(root, "stream_recordings");
+    if (stream_recordings_json) stream_recordings = json_boolean_value(stream_recordings_json);
+
+    json_t* capture_seconds_json = json_object_get(root, "capture_seconds");
+    if (capture_seconds_json && (json_integer_value(capture_seconds_json) > 0))
+    {
+      capture_seconds = json_integer_value(capture_seconds_json);
+      configure_recording();
+    }
+  }
+
+  // Recording lengths are in frames, so they depend on the sample rate
+  void onSampleRateChange() override
+  {
+    configure_recording();
+  }
+
+  void set_maximum_recording_minutes(unsigned int minutes)
+  {
+    maximum_recording_minutes = minutes;
+    configure_recording();
+  }
+
+  void set_capture_seconds(unsigned int seconds)
+  {
+    capture_seconds = seconds;
+    configure_recording();
+  }
+
+  void configure_recording()
+  {
+    float sample_rate = APP->engine->getSampleRate();
+    double maximum_frames = (double) maximum_recording_minutes * 60.0 * sample_rate;
+    sample->configure_recording((unsigned int) std::min(maximum_frames, (double) std::numeric_limits<unsigned int>::max()), sample_rate);
+
+    double capture_frames = (double) capture_seconds * sample_rate;
+    capture_ring.configure((unsigned int) std::min(capture_frames, (double) std::numeric_limits<unsigned int>::max()), sample_rate);
+  }
+
+  // Get sample slot for where GEMK2 should store the sample
+  unsigned int selected_sample_slot()
+  {
+    unsigned int sample_slot = inputs[SAMPLE_SLOT_INPUT].getVoltage();
+    sample_slot += params[SAMPLE_SLOT_KNOB_PARAM].getValue();
+    return(clamp(sample_slot, 0, NUMBER_OF_SAMPLE_SLOTS - 1));
+  }
+
+  // A take can only be handed off once the outbox is free, and when saving,
+  // once the last one is with the writer
+  bool ready_to_send()
+  {
+    return(! outbox_full && ! (save_recordings && job_pending));
+  }
+
+  // Send the take in the outbox to Grain Engine MK2, and have the writer save
+  // it to disk when saving is turned on.  Grain Engine MK2 hears about the
+  // file once it's been saved; see poll_saves().
+  void send_take(unsigned int sample_slot)
+  {
+    outbox.sample_slot = sample_slot;
+    outbox.path.clear();
+    outbox.take_number = 0;
+
+    if(save_recordings && (! take_paths[sample_slot].empty()))
+    {
+      // Hand a second reference to the take to the writer, which saves it to disk
+      take_number++;
+      pending_job.take = outbox.take;
+      pending_job.path = take_paths[sample_slot];
+      pending_job.take_number = take_number;
+      pending_job.status = save_statuses[sample_slot];
+      job_pending = true;
+
+      outbox.take_number = take_number;
+      saving_takes[sample_slot] = take_number;
+    }
+
+    outbox_full = true;
+  }
+
+  // Check on the takes that the writer is saving.  Once one has been saved,
+  // Grain Engine MK2 is told, so that it can name the slot after the file.
+  // A take that's been superseded in its slot is never heard about, since
+  // the newer one is saved to the same file.
+  void poll_saves()
+  {
+    for(unsigned int i = 0; i < NUMBER_OF_SAMPLE_SLOTS; i++)
+    {
+      if(saving_takes[i] == 0) continue;
+
+      if(save_statuses[i]->failed_take.load(std::memory_order_acquire) == saving_takes[i])
+      {
+        saving_takes[i] = 0;
+        save_failed = true;
+      }
+      else if((save_statuses[i]->saved_take.load(std::memory_order_acquire) == saving_takes[i]) && ! outbox_full)
+      {
+        outbox.sample_slot = i;
+        outbox.path = take_paths[i];
+        outbox.take_number = saving_takes[i];
+        outbox_full = true;
+
+        saving_takes[i] = 0;
+        save_failed = false;
+      }
+    }
+  }
+
+  // True once Grain Engine MK2 is done with 'message'.  It clears the take
+  // when it picks one up.
+  bool delivered(const GrainEngineExpanderMessage *message)
+  {
+    return(message->message_received && ! message->take.audio);
+  }
+
+  // Move the outbox over to Grain Engine MK2.  Rack swaps the two message
+  // buffers every frame, so both of them have to be free, or a message that's
+  // still waiting in the other one would be written over after the swap.
+  // The take is swapped in rather than copied, so that the empty one left
+  // behind is all that the outbox lets go of.
+  void deliver(Module *grain_engine)
+  {
+    if(! outbox_full) return;
+
+    GrainEngineExpanderMessage *producer_message = (GrainEngineExpanderMessage *) grain_engine->leftExpander.producerMessage;
+    GrainEngineExpanderMessage *consumer_message = (GrainEngineExpanderMessage *) grain_engine->leftExpander.consumerMessage;
+
+    if(! (delivered(producer_message) && delivered(consumer_message))) return;
+
+    producer_message->sample_slot = outbox.sample_slot;
+    producer_message->path = outbox.path;
+    producer_message->take_number = outbox.take_number;
+    std::swap(producer_message->take, outbox.take);
+
+    // Tell Grain Engine MK2 that the message is ready for receiving
+    producer_message->message_received = false;
+    outbox_full = false;
+  }
+
+  // Stop streaming, and have Grain Engine MK2 load the file once it's done
+  void stop_stream(unsigned int sample_slot)
+  {
+    stream_sample_slot = sample_slot;
+    stream_path = take_paths[sample_slot];
+
+    // Takes that are sent meanwhile count up 'take_number' too
+    stream_take_number = ++take_number;
+    stream->stop(stream_path, stream_take_number);
+    stream_notification_pending = true;
+  }
+
+  // In the format grain_engine_[patch_uuid]_s[sample_slot].wav
+  std::string take_filename(unsigned int sample_slot)
+  {
+    return("grain_engine_" + patch_uuid + "_s" + std::to_string(sample_slot) + ".wav");
+  }
+
+  // Not on the audio thread.  Has to be called whenever 'patch_uuid' changes.
+  void update_take_paths()
+  {
+    for(unsigned int i = 0; i < NUMBER_OF_SAMPLE_SLOTS; i++)
+    {
+      take_paths[i].assign(recording_folder + "/" + take_filename(i));
+    }
   }
 
 	void process(const ProcessArgs &args) override {
@@ -94,49 +349,110 @@ struct GrainEngineMK2Expander : Module
       if(recording && start_recording)
       {
         stop_recording = true;
+        start_recording = false;
       }
 
-      if(! stop_recording)
+      if(stop_recording)
       {
-        if(start_recording)
+        start_waiting = false;
+
+        if(recording && streaming)
         {
-          sample->initialize_recording();
-          recording = true;
+          recording = false;
+          stop_stream(selected_sample_slot());
         }
+        else if(recording)
+        {
+          // The take is finished as soon as it can be sent
+          recording = false;
+          take_waiting = true;
+          take_sample_slot = selected_sample_slot();
+        }
+      }
+
+      // The recorded audio goes along with the message
+      if(take_waiting && ready_to_send())
+      {
+        sample->finish_recording(outbox.take);
+        send_take(take_sample_slot);
+        take_waiting = false;
+      }
+
+      // Starting again would record over a take that hasn't been sent yet
+      if(start_recording) start_waiting = true;
+
+      if(start_waiting && ! take_waiting)
+      {
+        start_waiting = false;
+
+        // A stream can't start again until the last take has been finished
+        streaming = stream_recordings;
 
-        if(recording)
+        if(streaming)
         {
-          sample->record_audio(left, right);
+          recording = stream->start(args.sampleRate);
+        }
+        else
+        {
+          sample->initialize_recording();
+          recording = true;
         }
       }
 
-      if(stop_recording)
+      if(recording)
       {
-        recording = false;
+        if(streaming) stream->push(left, right);
+        else sample->record_audio(left, right);
+      }
+
+      if(stream_notification_pending)
+      {
+        if(stream_status->saved_take.load(std::memory_order_acquire) == stream_take_number)
+        {
+          // Waits for the outbox like anything else
+          if(! outbox_full)
+          {
+            outbox.sample_slot = stream_sample_slot;
+            outbox.path = stream_path;
+            outbox.take_number = 0;
+            outbox_full = true;
+            stream_notification_pending = false;
+            save_failed = false;
+          }
+        }
+        else if(stream_status->failed_take.load(std::memory_order_acquire) == stream_take_number)
+        {
+          stream_notification_pending = false;
+          save_failed = true;
+        }
+      }
 
-        // Get sample slot for where GEMK2 should store the sample
-        unsigned int sample_slot = inputs[SAMPLE_SLOT_INPUT].getVoltage();
-        sample_slot += params[SAMPLE_SLOT_KNOB_PARAM].getValue();
-        sample_slot = clamp(sample_slot, 0, 4);
+      // The capture ring hands over whatever it's heard, up to the last
+      // 'capture_seconds', without copying it
+      capture_ring.push(left, right);
 
-        // Build up a filename for the .wav file in the format grain_engine_[patch_uuid]_s[sample_slot].wave
-        if(patch_uuid == "") patch_uuid = random_string(12);
-        std::string path = asset::user(WAV_FOLDER_NAME);
-        std::string filename = "grain_engine_" + patch_uuid + "_s" + std::to_string(sample_slot) + ".wav";
+      bool capture = capture_button_trigger.process(params[CAPTURE_BUTTON_PARAM].getValue()) || capture_input_trigger.process(inputs[CAPTURE_INPUT].getVoltage());
 
-        // Prepare message for sending to Grain Engine MK2
-        GrainEngineExpanderMessage *message_to_grain_engine = (GrainEngineExpanderMessage *) rightExpander.module->leftExpander.producerMessage;
-        message_to_grain_engine->sample_slot = sample_slot;
-        message_to_grain_engine->path = path;
-        message_to_grain_engine->filename = filename;
+      if(capture && ! capture_waiting)
+      {
+        capture_waiting = true;
+        capture_sample_slot = selected_sample_slot();
+      }
 
-        // Save the recorded audio to disk
-        sample->save_recorded_audio(path + "/" + filename);
+      if(capture_waiting && ready_to_send())
+      {
+        if(capture_ring.commit(outbox.take)) send_take(capture_sample_slot);
+        capture_waiting = false;
+      }
 
-        // Tell Grain Engine MK2 that the message is ready for receiving
-        message_to_grain_engine->message_received = false;
+      if(job_pending && writer->try_queue(pending_job))
+      {
+        job_pending = false;
       }
 
+      poll_saves();
+      deliver(rightExpander.module);
+
       outputs[PASSTHROUGH_LEFT].setVoltage(left);
       outputs[PASSTHROUGH_RIGHT].setVoltage(right);
 
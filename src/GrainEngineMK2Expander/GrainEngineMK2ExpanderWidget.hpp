@@ -33,13 +33,107 @@ struct GrainEngineMK2ExpanderWidget : ModuleWidget
     addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col_1, row_4)), module, GrainEngineMK2Expander::SAMPLE_SLOT_INPUT));
     addParam(createParamCentered<Trimpot>(mm2px(Vec(col_2, row_4)), module, GrainEngineMK2Expander::SAMPLE_SLOT_KNOB_PARAM));
 
+    // Capture, between row 4 and the outputs
+    float capture_row = (row_4 + 114.702) / 2.0;
+    addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col_1, capture_row)), module, GrainEngineMK2Expander::CAPTURE_INPUT));
+    addParam(createParamCentered<LEDButton>(mm2px(Vec(col_2, capture_row)), module, GrainEngineMK2Expander::CAPTURE_BUTTON_PARAM));
+
     addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(col_1, 114.702)), module, GrainEngineMK2Expander::PASSTHROUGH_LEFT));
     addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(col_2, 114.702)), module, GrainEngineMK2Expander::PASSTHROUGH_RIGHT));
   }
 
+  // Memory for recording is set aside ahead of time, up to this length
+  struct MaximumRecordingLengthMenuItem : MenuItem
+  {
+    GrainEngineMK2Expander *module;
+    unsigned int minutes;
+
+    void onAction(const event::Action &e) override
+    {
+      module->set_maximum_recording_minutes(minutes);
+    }
+  };
+
+  struct CaptureLengthMenuItem : MenuItem
+  {
+    GrainEngineMK2Expander *module;
+    unsigned int seconds;
+
+    void onAction(const event::Action &e) override
+    {
+      module->set_capture_seconds(seconds);
+    }
+  };
+
+  struct SaveRecordingsMenuItem : MenuItem
+  {
+    GrainEngineMK2Expander *module;
+
+    void onAction(const event::Action &e) override
+    {
+      module->save_recordings = ! module->save_recordings;
+    }
+  };
+
+  struct StreamRecordingsMenuItem : MenuItem
+  {
+    GrainEngineMK2Expander *module;
+
+    void onAction(const event::Action &e) override
+    {
+      module->stream_recordings = ! module->stream_recordings;
+    }
+  };
+
   void appendContextMenu(Menu *menu) override
   {
     GrainEngineMK2Expander *module = dynamic_cast<GrainEngineMK2Expander*>(this->module);
     assert(module);
+
+    menu->addChild(new MenuEntry); // For spacing only
+
+    if(module->save_failed)
+    {
+      menu->addChild(createMenuLabel("The last recording couldn't be saved"));
+      menu->addChild(new MenuEntry); // For spacing only
+    }
+
+    // Recordings play in Grain Engine MK2 either way.  Saving them is what
+    // lets them come back when the patch is reopened.
+    SaveRecordingsMenuItem *save_recordings_menu_item = createMenuItem<SaveRecordingsMenuItem>("Save recordings to disk", CHECKMARK(module->save_recordings));
+    save_recordings_menu_item->module = module;
+    menu->addChild(save_recordings_menu_item);
+
+    // Streaming takes have no length limit and use hardly any memory, but
+    // Grain Engine MK2 has to load them from disk once they're finished
+    StreamRecordingsMenuItem *stream_recordings_menu_item = createMenuItem<StreamRecordingsMenuItem>("Stream long recordings to disk", CHECKMARK(module->stream_recordings));
+    stream_recordings_menu_item->module = module;
+    menu->addChild(stream_recordings_menu_item);
+
+    menu->addChild(new MenuEntry); // For spacing only
+    menu->addChild(createMenuLabel("Longest recording"));
+
+    unsigned int minutes[] = {1, 5, 10, 30, 60};
+
+    for(unsigned int option : minutes)
+    {
+      MaximumRecordingLengthMenuItem *menu_item = createMenuItem<MaximumRecordingLengthMenuItem>(std::to_string(option) + " minutes", CHECKMARK(module->maximum_recording_minutes == option));
+      menu_item->module = module;
+      menu_item->minutes = option;
+      menu->addChild(menu_item);
+    }
+
+    menu->addChild(new MenuEntry); // For spacing only
+    menu->addChild(createMenuLabel("Capture length"));
+
+    unsigned int seconds[] = {5, 10, 30, 60, 120};
+
+    for(unsigned int option : seconds)
+    {
+      CaptureLengthMenuItem *menu_item = createMenuItem<CaptureLengthMenuItem>(std::to_string(option) + " seconds", CHECKMARK(module->capture_seconds == option));
+      menu_item->module = module;
+      menu_item->seconds = option;
+      menu->addChild(menu_item);
+    }
   }
 };
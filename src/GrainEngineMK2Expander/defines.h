@@ -1 +1,12 @@
 #define WAV_FOLDER_NAME "gemk2es_audio_files"
+
+// Grain Engine MK2's sample slots that a take can be sent to
+#define NUMBER_OF_SAMPLE_SLOTS 5
+
+// The longest take that can be recorded, in minutes, until it's changed from
+// the context menu
+#define DEFAULT_MAXIMUM_RECORDING_MINUTES 10
+
+// How many seconds of audio a capture keeps, until it's changed from the
+// context menu
+#define DEFAULT_CAPTURE_SECONDS 30
@@ -5,7 +5,9 @@ struct Repeater : Module
 	int step = 0;
 	bool isPlaying = false;
 	SmoothSubModule smooth;
+	SampleCursor cursor;
 	int retrigger;
+	bool snap_to_onsets = false;
 	std::string root_dir;
 
 	// When this flag is flase, the display area on the front panel will
@@ -17,6 +19,7 @@ struct Repeater : Module
 	bool trig_input_is_connected = false;
 
 	Sample samples[NUMBER_OF_SAMPLES];
+	SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
 	std::string loaded_filenames[NUMBER_OF_SAMPLES] = {""};
 
 	dsp::SchmittTrigger playTrigger;
@@ -68,6 +71,9 @@ struct Repeater : Module
 		configParam(SMOOTH_SWITCH, 0.f, 1.f, 1.f, "Smooth");
 
 		std::fill_n(loaded_filenames, NUMBER_OF_SAMPLES, "[ EMPTY ]");
+
+		// Samples are resampled to the engine's rate as they load
+		onSampleRateChange();
 	}
 
 	// Autosave module data.  VCV Rack decides when this should be called.
@@ -78,17 +84,25 @@ struct Repeater : Module
 		for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
 			json_object_set_new(rootJ, ("loaded_sample_path_" + std::to_string(i+1)).c_str(), json_string(samples[i].path.c_str()));
+			sample_region_to_json(rootJ, i+1, samples[i].region);
 		}
 
 		json_object_set_new(rootJ, "retrigger", json_integer(retrigger));
+		json_object_set_new(rootJ, "snap_to_onsets", json_boolean(snap_to_onsets));
+		json_object_set_new(rootJ, "sample_encoding", json_integer(sample_encoding));
+
 		return rootJ;
 	}
 
 	// Load module data
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
 		for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
+			samples[i].region = sample_region_from_json(rootJ, i+1);
+
 			json_t *loaded_sample_path = json_object_get(rootJ, ("loaded_sample_path_" +  std::to_string(i+1)).c_str());
 			if (loaded_sample_path)
 			{
@@ -100,6 +114,35 @@ struct Repeater : Module
 			json_t* retrigger_json = json_object_get(rootJ, "retrigger");
 			if (retrigger_json) retrigger = json_integer_value(retrigger_json);
 		}
+
+		json_t* snap_to_onsets_json = json_object_get(rootJ, "snap_to_onsets");
+		if (snap_to_onsets_json) snap_to_onsets = json_is_true(snap_to_onsets_json);
+	}
+
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			samples[i].encoding = encoding;
+			if(reload && (samples[i].path != "")) samples[i].load(samples[i].path);
+		}
+	}
+
+	// The sample that the waveform display shows
+	Sample *displayed_sample()
+	{
+		return(&samples[selected_sample_slot]);
+	}
+
+	// Loaded samples are resampled again in the background whenever the engine's
+	// rate changes.  Until that finishes they keep playing at their old rate.
+	void onSampleRateChange() override
+	{
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) samples[i].set_target_sample_rate(APP->engine->getSampleRate());
 	}
 
 	// TODO: Eventually share this code instead of duplicating it
@@ -120,6 +163,9 @@ struct Repeater : Module
 	{
 		bool trigger_output_pulse = false;
 
+		// Pick up any samples that have finished loading in the background
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) samples[i].poll();
+
 		unsigned int sample_select_input_value = calculate_inputs(SAMPLE_SELECT_INPUT, SAMPLE_SELECT_KNOB, SAMPLE_SELECT_ATTN_KNOB, NUMBER_OF_SAMPLES_FLOAT);
 		sample_select_input_value = clamp(sample_select_input_value, 0, NUMBER_OF_SAMPLES - 1);
 
@@ -155,6 +201,16 @@ struct Repeater : Module
 				{
 					isPlaying = true;
 					samplePos = calculate_inputs(POSITION_INPUT, POSITION_KNOB, POSITION_ATTN_KNOB, selected_sample->size());
+
+					if(samplePos >= 0)
+					{
+						// Start on the hit closest to the position instead of part way into one
+						if(snap_to_onsets) samplePos = selected_sample->nearest_onset(samplePos);
+
+						// Start on a zero crossing, which usually lets the smoothing be skipped
+						samplePos = selected_sample->nearest_zero_crossing(samplePos);
+					}
+
 					smooth.trigger();
 					triggerOutputPulse.trigger(0.01f);
 				}
@@ -170,11 +226,13 @@ struct Repeater : Module
 
 		if(retrigger && abs(floor(samplePos)) >= selected_sample->size())
 		{
-			samplePos = 0;
+			samplePos = selected_sample->nearest_zero_crossing(0);
 			smooth.trigger();
 		}
 
-		if (isPlaying && (! selected_sample->loading) && (selected_sample->loaded) && (selected_sample->size() > 0) && ((abs(floor(samplePos)) < selected_sample->size())))
+		// Keep playing through a reload.  The old buffer is good until it's
+		// swapped out.
+		if (isPlaying && (selected_sample->loaded) && (selected_sample->size() > 0) && ((abs(floor(samplePos)) < selected_sample->size())))
 		{
 			float wav_output_voltage;
       float left_output;
@@ -183,19 +241,20 @@ struct Repeater : Module
 			if (samplePos >= 0)
 			{
 				// wav_output_voltage = GAIN  * selected_sample->leftPlayBuffer[floor(samplePos)];
-        std::tie(left_output, right_output) = selected_sample->read(floor(samplePos));
+        std::tie(left_output, right_output) = cursor.read(selected_sample, floor(samplePos));
 			}
 			else
 			{
-        std::tie(left_output, right_output) = selected_sample->read(floor(selected_sample->size() - 1 + samplePos));
+        std::tie(left_output, right_output) = cursor.read(selected_sample, floor(selected_sample->size() - 1 + samplePos));
 				// What is this for?  Does it play the sample in reverse?  I think so.
 				// wav_output_voltage = GAIN * selected_sample->leftPlayBuffer[floor(selected_sample->size() - 1 + samplePos)];
 			}
 
-      wav_output_voltage = GAIN * left_output;
+			// Apply smoothing.  This happens before the gain, since it's the
+			// unscaled audio that the smoothing compares jumps against.
+			if(params[SMOOTH_SWITCH].getValue()) left_output = smooth.process(left_output, (128.0f / args.sampleRate));
 
-			// Apply smoothing
-			if(params[SMOOTH_SWITCH].getValue()) wav_output_voltage = smooth.process(wav_output_voltage, (128.0f / args.sampleRate));
+      wav_output_voltage = GAIN * left_output;
 
 			// Output voltage
 			outputs[WAV_OUTPUT].setVoltage(wav_output_voltage);
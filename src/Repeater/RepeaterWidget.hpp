@@ -47,6 +47,12 @@ struct RepeaterWidget : ModuleWidget
 		readout->module = module;
 		addChild(readout);
 
+		SampleWaveformDisplay<Repeater> *waveform_display = new SampleWaveformDisplay<Repeater>();
+		waveform_display->box.pos = mm2px(Vec(9.0, 24.8));
+		waveform_display->box.size = mm2px(Vec(68.0, 3.4));
+		waveform_display->module = module;
+		addChild(waveform_display);
+
 		// Outputs
 		addOutput(createOutput<PJ301MPort>(Vec(200, 324), module, Repeater::WAV_OUTPUT));
 		addOutput(createOutput<PJ301MPort>(Vec(200, 259), module, Repeater::TRG_OUTPUT));
@@ -73,6 +79,14 @@ struct RepeaterWidget : ModuleWidget
 			menu->addChild(menu_item_load_sample);
 		}
 
+		menu->addChild(new MenuEntry); // For spacing only
+		menu->addChild(createMenuLabel("Load regions"));
+
+		for(int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			append_sample_region_menu(menu, &module->samples[i], std::to_string(i+1) + ": " + module->loaded_filenames[i]);
+		}
+
 		//
 		// Options
 		// =====================================================================
@@ -93,6 +107,22 @@ struct RepeaterWidget : ModuleWidget
 		retrigger_menu_item->rightText = CHECKMARK(module->retrigger == 1);
 		retrigger_menu_item->module = module;
 		menu->addChild(retrigger_menu_item);
+
+		// Snap to onsets option
+
+		struct SnapToOnsetsMenuItem : MenuItem {
+			Repeater* module;
+			void onAction(const event::Action& e) override {
+				module->snap_to_onsets = !(module->snap_to_onsets);
+			}
+		};
+
+		SnapToOnsetsMenuItem* snap_to_onsets_menu_item = createMenuItem<SnapToOnsetsMenuItem>("Snap position to onsets");
+		snap_to_onsets_menu_item->rightText = CHECKMARK(module->snap_to_onsets);
+		snap_to_onsets_menu_item->module = module;
+		menu->addChild(snap_to_onsets_menu_item);
+
+		append_sample_encoding_menu(menu, module);
 	}
 
 };
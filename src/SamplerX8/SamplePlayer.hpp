@@ -2,6 +2,7 @@ struct SamplePlayer
 {
 	// sample_ptr points to the loaded sample in memory
 	Sample sample;
+  SampleCursor cursor;
 	float playback_position = 0.0f;
   unsigned int sample_position = 0;
   bool playing = false;
@@ -11,7 +12,7 @@ struct SamplePlayer
     sample_position = playback_position; // convert float to int
     if((playing == false) || (sample_position >= this->sample.size()) || (sample.loaded == false)) return { 0,0 };
     float left; float right;
-    std::tie(left, right) = this->sample.read(sample_position);
+    std::tie(left, right) = cursor.read(&this->sample, sample_position);
 		return { left, right };
 	}
 
@@ -45,6 +46,11 @@ struct SamplePlayer
     sample.load(path);
   }
 
+  void poll()
+  {
+    sample.poll();
+  }
+
   std::string getFilename()
   {
     return(sample.filename);
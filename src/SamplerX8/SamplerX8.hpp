@@ -1,7 +1,8 @@
 struct SamplerX8 : Module
 {
 	std::string loaded_filenames[NUMBER_OF_SAMPLES] = {""};
-  std::vector<SamplePlayer> sample_players;
+  SamplePlayer sample_players[NUMBER_OF_SAMPLES];
+  SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
   dsp::SchmittTrigger sample_triggers[NUMBER_OF_SAMPLES];
   float left_audio = 0;
   float right_audio = 0;
@@ -62,11 +63,8 @@ struct SamplerX8 : Module
     config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
     std::fill_n(loaded_filenames, NUMBER_OF_SAMPLES, "[ EMPTY ]");
 
-    for(unsigned int i=0; i<NUMBER_OF_SAMPLES; i++)
-    {
-      SamplePlayer sample_player;
-      sample_players.push_back(sample_player);
-    }
+		// Samples are resampled to the engine's rate as they load
+		onSampleRateChange();
 	}
 
 	// Autosave module data.  VCV Rack decides when this should be called.
@@ -79,12 +77,16 @@ struct SamplerX8 : Module
 			json_object_set_new(root, ("loaded_sample_path_" + std::to_string(i+1)).c_str(), json_string(sample_players[i].getPath().c_str()));
 		}
 
+		json_object_set_new(root, "sample_encoding", json_integer(sample_encoding));
+
 		return root;
 	}
 
 	// Load module data
 	void dataFromJson(json_t *root) override
 	{
+		set_sample_encoding(sample_encoding_from_json(root), false);
+
     for(int i=0; i < NUMBER_OF_SAMPLES; i++)
 		{
 			json_t *loaded_sample_path = json_object_get(root, ("loaded_sample_path_" +  std::to_string(i+1)).c_str());
@@ -96,10 +98,33 @@ struct SamplerX8 : Module
 		}
 	}
 
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
+	{
+		this->sample_encoding = encoding;
+
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++)
+		{
+			sample_players[i].sample.encoding = encoding;
+			if(reload && (sample_players[i].sample.path != "")) sample_players[i].sample.load(sample_players[i].sample.path);
+		}
+	}
+
+	// Loaded samples are resampled again in the background whenever the engine's
+	// rate changes.  Until that finishes they keep playing at their old rate.
+	void onSampleRateChange() override
+	{
+		for(unsigned int i=0; i < NUMBER_OF_SAMPLES; i++) sample_players[i].sample.set_target_sample_rate(APP->engine->getSampleRate());
+	}
+
 	void process(const ProcessArgs &args) override
 	{
     for(unsigned int i=0; i<NUMBER_OF_SAMPLES; i++)
     {
+      // Pick up the sample if it has finished loading in the background
+      sample_players[i].poll();
+
       // Process trigger inputs to start sample playback
       if (sample_triggers[i].process(rescale(inputs[i].getVoltage(), 0.0f, 10.0f, 0.f, 1.f))) sample_players[i].trigger();
 
@@ -64,5 +64,7 @@ struct SamplerX8Widget : ModuleWidget
       menu_item_load_sample->module = module;
       menu->addChild(menu_item_load_sample);
     }
+
+    append_sample_encoding_menu(menu, module);
   }
 };
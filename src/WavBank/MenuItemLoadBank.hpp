@@ -15,3 +15,21 @@ struct MenuItemLoadBank : MenuItem
 		}
 	}
 };
+
+struct MenuItemLoadBankFile : MenuItem
+{
+	WavBank *wav_bank_module;
+
+	void onAction(const event::Action &e) override
+	{
+		const std::string dir = wav_bank_module->rootDir;
+		char *path = osdialog_file(OSDIALOG_OPEN, dir.c_str(), NULL, osdialog_filters_parse("Sample Bank:" SAMPLE_BANK_EXTENSION));
+
+		if (path)
+		{
+			wav_bank_module->load_samples_from_bank(path);
+			wav_bank_module->path = path;
+			free(path);
+		}
+	}
+};
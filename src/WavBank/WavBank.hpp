@@ -7,7 +7,17 @@ struct WavBank : Module
 	std::string rootDir;
 	std::string path;
 
-	std::vector<Sample> samples;
+	unsigned int poll_index = 0;
+
+	// The bank that's playing.  Only the audio thread touches it.  New banks
+	// are read in the background and swapped in by process().  Samples are
+	// loaded in the background too, and only once the selection gets close to
+	// them.  See WavBankCache.
+	WavBankSamplesHandle *bank = nullptr;
+	std::shared_ptr<WavBankCache> cache = std::make_shared<WavBankCache>();
+	std::shared_ptr<SampleLoader> loader = get_sample_loader();
+	SampleEncoding sample_encoding = SAMPLE_ENCODING_FLOAT32;
+	SampleCursor cursor;
 	dsp::SchmittTrigger playTrigger;
 
 	bool triggered = false;
@@ -42,47 +52,155 @@ struct WavBank : Module
 		configParam(WAV_KNOB, 0.0f, 1.0f, 0.0f, "SampleSelectKnob");
 		configParam(WAV_ATTN_KNOB, 0.0f, 1.0f, 1.0f, "SampleSelectAttnKnob");
 		configParam(LOOP_SWITCH, 0.0f, 1.0f, 0.0f, "LoopSwitch");
+
+		bank = new WavBankSamplesHandle(cache->samples);
+
+		std::shared_ptr<WavBankCache> cache = this->cache;
+		loader->housekeeping([cache]() { return cache->maintain(); });
+	}
+
+	~WavBank()
+	{
+		cache->close();
+		delete bank;
 	}
 
 	json_t *dataToJson() override
 	{
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "path", json_string(this->path.c_str()));
+		json_object_set_new(rootJ, "sample_encoding", json_integer(sample_encoding));
+		json_object_set_new(rootJ, "memory_budget", json_integer(cache->budget));
+
 		return rootJ;
 	}
 
 	void dataFromJson(json_t *rootJ) override
 	{
+		set_sample_encoding(sample_encoding_from_json(rootJ), false);
+
+		json_t *memory_budget_json = json_object_get(rootJ, "memory_budget");
+		if (memory_budget_json) cache->budget = std::max((json_int_t) 0, json_integer_value(memory_budget_json));
+
 		json_t *loaded_path_json = json_object_get(rootJ, ("path"));
 		if (loaded_path_json)
 		{
 			this->path = json_string_value(loaded_path_json);
-			this->load_samples_from_path(this->path.c_str());
+
+			if (rack::string::lowercase(rack::string::filenameExtension(this->path)) == SAMPLE_BANK_EXTENSION)
+			{
+				this->load_samples_from_bank(this->path.c_str());
+			}
+			else
+			{
+				this->load_samples_from_path(this->path.c_str());
+			}
 		}
 	}
 
-	void load_samples_from_path(const char *path)
+	// Change how this module's samples are stored in memory.  Samples that are
+	// already loaded get reloaded unless 'reload' is false.  The rest pick up
+	// the new encoding whenever they're loaded.
+	void set_sample_encoding(SampleEncoding encoding, bool reload = true)
 	{
-		// Clear out any old .wav files
-		this->samples.clear();
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		this->sample_encoding = encoding;
+		cache->encoding = encoding;
 
-		// Load all .wav files found in the folder specified by 'path'
+		WavBankSamples &samples = *cache->samples;
 
+		for(size_t i = 0; i < samples.size(); i++)
+		{
+			samples[i].encoding = encoding;
+			if(reload && cache->resident[i]) samples[i].reload();
+		}
+	}
+
+	// Loaded samples are resampled again in the background whenever the engine's
+	// rate changes.  Until that finishes they keep playing at their old rate.
+	void onSampleRateChange() override
+	{
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		unsigned int sample_rate = APP->engine->getSampleRate();
+		cache->sample_rate = sample_rate;
+
+		WavBankSamples &samples = *cache->samples;
+
+		for(size_t i = 0; i < samples.size(); i++)
+		{
+			if(cache->resident[i]) samples[i].set_target_sample_rate(sample_rate);
+			else samples[i].target_sample_rate = sample_rate;
+		}
+	}
+
+	// Change how many megabytes of decoded audio the bank can hold.  0 means
+	// there's no limit.
+	void set_memory_budget(unsigned int megabytes)
+	{
+		cache->budget = megabytes;
+	}
+
+	// Switch to the .wav files in the folder at 'path'.  The folder is read in
+	// the background, and whatever's playing keeps playing until it's ready.
+	void load_samples_from_path(const char *path)
+	{
 		this->rootDir = std::string(path);
-		std::list<std::string> dirList = system::getEntries(path);
+		queue_bank(path, false);
+	}
+
+	// Switch to the entries of a sample bank file, which is a folder of samples
+	// that has been packed into one file by tools/vgbank_builder.  Only the
+	// bank's directory is read here.  The entries play straight out of the
+	// file once they're selected, so they take no time to load and don't count
+	// against the memory budget.
+	void load_samples_from_bank(const char *path)
+	{
+		this->rootDir = std::string(path);
+		queue_bank(path, true);
+	}
+
+	void queue_bank(std::string path, bool bank_file)
+	{
+		std::shared_ptr<WavBankCache> cache = this->cache;
+		unsigned int generation = 0;
 
-		// TODO: Decide on a maximum memory consuption allowed and abort if
-		// that amount of member would be exhausted by loading all of the files
-		// in the folder.  Also consider supporting MP3.
-		for (auto entry : dirList)
 		{
-			if (rack::string::lowercase(rack::string::filenameExtension(entry)) == "wav")
+			std::lock_guard<std::mutex> lock(cache->mutex);
+			cache->sample_rate = APP->engine->getSampleRate();
+			generation = ++cache->generation;
+		}
+
+		loader->queue([cache, path, bank_file, generation]() {
+			// A bank that's been superseded, or whose module has gone away,
+			// while it waited in the queue is never read
 			{
-				Sample new_sample;
-				new_sample.load(entry);
-				this->samples.push_back(new_sample);
+				std::lock_guard<std::mutex> lock(cache->mutex);
+				if(cache->closed || (generation != cache->generation)) return;
+				cache->reading++;
 			}
-		}
+
+			WavBankSamplesHandle samples = bank_file ? WavBankCache::read_bank_file(path) : WavBankCache::read_folder(path);
+
+			std::lock_guard<std::mutex> lock(cache->mutex);
+
+			// A folder that can't be read, or that has been superseded, leaves
+			// the bank as it is
+			if(samples && (! cache->closed) && (generation == cache->generation)) cache->publish(samples);
+
+			// Anything that wasn't published is let go of before the module is
+			// told that the bank is finished.  See WavBankCache::close().
+			samples.reset();
+			cache->reading--;
+			cache->read.notify_all();
+		});
+	}
+
+	// UI thread.  The filename of the selected sample in the newest bank.
+	std::string selected_filename()
+	{
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		if(selected_sample_slot < cache->samples->size()) return((*cache->samples)[selected_sample_slot].filename);
+		return("");
 	}
 
 	float calculate_inputs(int input_index, int knob_index, int attenuator_index, float scale)
@@ -96,6 +214,17 @@ struct WavBank : Module
 
 	void process(const ProcessArgs &args) override
 	{
+		// Switch to a new bank once it has been read in the background.  The
+		// sample in the same slot starts over, as it would if the selection had
+		// changed.
+		if(cache->swap(bank))
+		{
+			smooth_ramp = 0;
+			samplePos = 0;
+			triggered = false;
+		}
+
+		WavBankSamples &samples = **bank;
 		unsigned int number_of_samples = samples.size();
 
 		// Read the input/knob for sample selection
@@ -122,8 +251,18 @@ struct WavBank : Module
 		// If not, return.  This could happen before any samples have been loaded.
 		if(! (samples.size() > selected_sample_slot)) return;
 
+		// Let the cache know which sample to have loaded
+		cache->selected = selected_sample_slot;
+
 		Sample *selected_sample = &samples[selected_sample_slot];
 
+		// Pick up samples that have finished loading in the background.  The
+		// selected sample is checked every frame.  The rest of the bank is
+		// checked one sample per frame so that large banks don't cost much.
+		selected_sample->poll();
+		poll_index = (poll_index + 1) % number_of_samples;
+		samples[poll_index].poll();
+
 		if (inputs[TRIG_INPUT].isConnected())
 		{
 			//
@@ -132,7 +271,7 @@ struct WavBank : Module
 			//
 			if (playTrigger.process(inputs[TRIG_INPUT].getVoltage()))
 			{
-				samplePos = 0;
+				samplePos = selected_sample->nearest_zero_crossing(0);
 				smooth_ramp = 0;
 				triggered = true;
 			}
@@ -143,9 +282,16 @@ struct WavBank : Module
 		}
 
 		// Loop
-		if(params[LOOP_SWITCH].getValue() && (samplePos >= selected_sample->size())) samplePos = 0;
+		if(params[LOOP_SWITCH].getValue() && (samplePos >= selected_sample->size()))
+		{
+			samplePos = selected_sample->nearest_zero_crossing(0);
+			smooth_ramp = 0;
+		}
 
-		if (triggered && (! selected_sample->loading) && (selected_sample->loaded) && (selected_sample->size() > 0) && (samplePos < selected_sample->size()))
+		// A sample that's being loaded again, such as after a change in the
+		// sample rate or the encoding, plays its old audio until poll() swaps
+		// in the new buffer
+		if (triggered && (selected_sample->loaded) && (selected_sample->size() > 0) && (samplePos < selected_sample->size()))
 		{
 			float left_wav_output_voltage;
 			float right_wav_output_voltage;
@@ -163,7 +309,7 @@ struct WavBank : Module
 					right_wav_output_voltage = left_wav_output_voltage;
 				}
         */
-        std::tie(left_wav_output_voltage, right_wav_output_voltage) = selected_sample->read((int)samplePos);
+        std::tie(left_wav_output_voltage, right_wav_output_voltage) = cursor.read(selected_sample, (int)samplePos);
 			}
 			else
 			{
@@ -177,12 +323,19 @@ struct WavBank : Module
 					right_wav_output_voltage = left_wav_output_voltage;
 				}
         */
-        std::tie(left_wav_output_voltage, right_wav_output_voltage) = selected_sample->read(floor(selected_sample->size() - 1 + samplePos));
+        std::tie(left_wav_output_voltage, right_wav_output_voltage) = cursor.read(selected_sample, floor(selected_sample->size() - 1 + samplePos));
 			}
 
       left_wav_output_voltage *= GAIN;
       right_wav_output_voltage *= GAIN;
 
+			// Jumps that land about where the audio already was, such as ones
+			// between zero crossings, don't need smoothing.  See SmoothSubModule.
+			if((smooth_ramp == 0) && (fabs(left_wav_output_voltage - last_wave_output_voltage[0]) < (SMOOTH_SKIP_THRESHOLD * GAIN)) && (fabs(right_wav_output_voltage - last_wave_output_voltage[1]) < (SMOOTH_SKIP_THRESHOLD * GAIN)))
+			{
+				smooth_ramp = 1;
+			}
+
 			if(SMOOTH_ENABLED && (smooth_ramp < 1))
 			{
 				float smooth_rate = (128.0f / args.sampleRate);  // A smooth rate of 128 seems to work best
@@ -0,0 +1,319 @@
+//
+// WavBankCache decides which of the bank's samples are held in memory.
+//
+// When a folder is loaded, every .wav in it gets a Sample that only knows its
+// path and filename.  Nothing is decoded until the selection gets close to
+// it.  Once the decoded samples add up to more than the memory budget, the
+// ones that were selected the longest time ago are unloaded until the bank
+// fits again.
+// The selected sample is never unloaded, even if it's bigger than the budget
+// on its own.
+//
+// The samples around the selected one are loaded ahead of time, so that
+// sweeping through the bank with CV doesn't land on samples that are still
+// loading.  The cache keeps track of how fast, and in which direction, the
+// selection is moving, and loads the samples on the way to where it's
+// expected to be next, along with a few on either side of it.  The selected
+// sample always counts as the most recently used, and the prefetched ones as
+// just behind it, so they're the last to be unloaded.
+//
+// The audio thread never loads or unloads anything itself.  It writes the
+// selected slot to 'selected', and the cache picks that up from the loader's
+// housekeeping thread, every SAMPLE_LOADER_HOUSEKEEPING_INTERVAL
+// milliseconds.  Everything else is guarded by 'mutex', which is only ever
+// taken off of the audio thread.
+//
+// Whole banks are handed to the audio thread the same way that a Sample's
+// buffers are.  A new folder is read on a loader thread, and the finished
+// bank is parked in 'pending'.  The audio thread swaps it in with swap(), and
+// leaves the bank that it was playing in 'retired', where housekeeping lets
+// go of it.  'samples' is always the newest bank, even before the audio
+// thread has picked it up, so it starts loading right away.
+//
+// A Sample holds a reference to the loader, and the loader can't shut down
+// from one of its own threads, so banks are only ever let go of on a loader
+// thread while the module, and its own reference, is still around.  See
+// close().
+//
+
+// Megabytes of decoded audio that a bank keeps in memory unless it's told
+// otherwise.  0 means there's no limit.
+#define WAV_BANK_DEFAULT_MEMORY_BUDGET 1024
+
+// Samples on either side of the selected one that are always loaded
+#define WAV_BANK_PREFETCH_NEIGHBOURS 2
+
+// How far ahead, in housekeeping intervals, to look for where the selection
+// is heading, and the most samples to load ahead of it.  Each prefetch also
+// has to leave room in the budget for the selected sample.
+#define WAV_BANK_PREFETCH_LOOKAHEAD 4
+#define WAV_BANK_PREFETCH_MAXIMUM 16
+
+// How quickly the estimate of the selection's speed follows changes, from 0
+// to 1.  Lower is steadier.
+#define WAV_BANK_PREFETCH_SMOOTHING 0.5f
+
+typedef std::vector<Sample> WavBankSamples;
+typedef std::shared_ptr<WavBankSamples> WavBankSamplesHandle;
+
+struct WavBankCache
+{
+	std::mutex mutex;
+	WavBankSamplesHandle samples = std::make_shared<WavBankSamples>();
+	std::vector<bool> resident;
+	std::vector<uint64_t> last_used;
+	uint64_t clock = 0;
+	bool closed = false;
+
+	// Where the selection was at the last housekeeping interval, and how many
+	// slots it has been moving per interval
+	unsigned int previous_selected = 0;
+	float velocity = 0;
+
+	// 'generation' is bumped every time a new bank is asked for, so that an
+	// older one that finishes late is thrown away.  'reading' counts the banks
+	// that a loader thread is in the middle of reading.  One that's still
+	// waiting in the loader's queue doesn't count, since it's never read once
+	// the cache is closed.
+	unsigned int generation = 0;
+	unsigned int reading = 0;
+	std::condition_variable read;
+
+	// What every Sample in a new bank is set up with
+	SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32;
+	unsigned int sample_rate = 0;
+
+	std::atomic<WavBankSamplesHandle *> pending;
+	std::atomic<WavBankSamplesHandle *> retired;
+
+	std::atomic<unsigned int> selected;
+	std::atomic<unsigned int> budget; // in megabytes
+
+	WavBankCache() : pending(nullptr), retired(nullptr), selected(0), budget(WAV_BANK_DEFAULT_MEMORY_BUDGET)
+	{
+	}
+
+	~WavBankCache()
+	{
+		delete pending.load();
+		delete retired.load();
+	}
+
+	// Loader thread.  A bank with a Sample for every .wav file in the folder at
+	// 'path'.  Nothing is decoded until it's selected, and the cache keeps the
+	// memory that the bank uses within its budget.
+	static WavBankSamplesHandle read_folder(const std::string &path)
+	{
+		std::list<std::string> dirList = rack::system::getEntries(path);
+
+		// TODO: Consider supporting MP3.
+		dirList.remove_if([](const std::string &entry) { return(rack::string::lowercase(rack::string::filenameExtension(entry)) != "wav"); });
+
+		// Room for the whole bank is set aside first, so the samples are built
+		// in place and never moved
+		WavBankSamplesHandle samples = std::make_shared<WavBankSamples>();
+		samples->reserve(dirList.size());
+
+		for (auto entry : dirList)
+		{
+			samples->emplace_back();
+			samples->back().path = entry;
+			samples->back().filename = rack::string::filename(entry);
+		}
+
+		return(samples);
+	}
+
+	// Loader thread.  A bank with a Sample for every entry in the sample bank
+	// file at 'path', or nullptr if it isn't one.
+	static WavBankSamplesHandle read_bank_file(const std::string &path)
+	{
+		std::shared_ptr<const SampleBank> sample_bank = SampleBank::open(path);
+		if (! sample_bank) return(nullptr);
+
+		WavBankSamplesHandle samples = std::make_shared<WavBankSamples>();
+		samples->reserve(sample_bank->size());
+
+		for (unsigned int i = 0; i < sample_bank->size(); i++)
+		{
+			samples->emplace_back();
+			samples->back().path = path;
+			samples->back().bank_entry = i;
+			samples->back().filename = sample_bank->name(i);
+		}
+
+		return(samples);
+	}
+
+	// Loader thread, with the mutex held.  Makes 'bank' the newest bank, and
+	// hands it to the audio thread.
+	void publish(WavBankSamplesHandle bank)
+	{
+		for(Sample &sample : *bank)
+		{
+			sample.encoding = encoding;
+			sample.target_sample_rate = sample_rate;
+		}
+
+		samples = bank;
+		resident.assign(samples->size(), false);
+		last_used.assign(samples->size(), 0);
+		previous_selected = 0;
+		velocity = 0;
+
+		// A bank that the audio thread never picked up can go right away
+		delete pending.exchange(new WavBankSamplesHandle(bank));
+	}
+
+	// Audio thread.  If there's a new bank waiting, this retires 'active' and
+	// replaces it with the new one.  It never blocks, allocates or frees, and
+	// returns true when the bank changed.
+	bool swap(WavBankSamplesHandle *&active)
+	{
+		if(pending.load(std::memory_order_acquire) == nullptr) return(false);
+
+		// Wait until housekeeping has let go of the last bank that was retired
+		if(retired.load(std::memory_order_acquire) != nullptr) return(false);
+
+		retired.store(active, std::memory_order_release);
+		active = pending.exchange(nullptr, std::memory_order_acq_rel);
+		return(true);
+	}
+
+	// UI thread, from the module's destructor.  Waits for a bank that's in the
+	// middle of being read, which is quick since nothing is decoded, then lets
+	// go of every bank but the one that's playing, which belongs to the
+	// module.  Banks that are still queued behind other loader jobs aren't
+	// waited for.  They hold on to the cache, and give up as soon as they
+	// see that it's closed.
+	void close()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		closed = true;
+		read.wait(lock, [this]() { return(reading == 0); });
+
+		delete pending.exchange(nullptr);
+		delete retired.exchange(nullptr);
+		samples.reset();
+	}
+
+	// Housekeeping thread.  Returns true once the module has gone away.
+	bool maintain()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(closed) return(true);
+
+		delete retired.exchange(nullptr);
+
+		unsigned int slot = selected;
+		if(slot >= samples->size()) return(false);
+
+		float movement = (float) slot - (float) previous_selected;
+		velocity += (movement - velocity) * WAV_BANK_PREFETCH_SMOOTHING;
+		previous_selected = slot;
+
+		std::vector<unsigned int> wanted = prefetch_order(slot);
+
+		// Touched from the least wanted up, so that the selected sample is the
+		// most recently used
+		for(auto i = wanted.rbegin(); i != wanted.rend(); ++i) last_used[*i] = ++clock;
+
+		for(unsigned int i : wanted)
+		{
+			if(! resident[i])
+			{
+				resident[i] = true;
+				(*samples)[i].reload();
+			}
+		}
+
+		evict(slot);
+		return(false);
+	}
+
+	// The selected slot, followed by the ones to load ahead of it, most wanted
+	// first.  Slots in the direction that the selection is moving come before
+	// the ones behind it, and the run ahead reaches as far as the selection is
+	// expected to get within WAV_BANK_PREFETCH_LOOKAHEAD intervals.  Call with
+	// the mutex held.
+	std::vector<unsigned int> prefetch_order(unsigned int slot)
+	{
+		std::vector<unsigned int> order = { slot };
+
+		int direction = (velocity < 0) ? -1 : 1;
+		int ahead = std::max(WAV_BANK_PREFETCH_NEIGHBOURS, (int) std::ceil(std::fabs(velocity) * WAV_BANK_PREFETCH_LOOKAHEAD));
+		int count = (int) samples->size();
+
+		// Leave out whatever wouldn't fit in the budget next to the selected
+		// sample, going by the size of the samples that are loaded so far
+		size_t limit = WAV_BANK_PREFETCH_MAXIMUM;
+		size_t average = average_memory_used();
+
+		if((budget > 0) && (average > 0))
+		{
+			limit = std::min(limit, ((size_t) budget * 1024 * 1024) / average);
+			limit = (limit > 0) ? (limit - 1) : 0;
+		}
+
+		for(int distance = 1; (distance <= ahead) && (order.size() <= limit); distance++)
+		{
+			int next = (int) slot + (distance * direction);
+			if((next >= 0) && (next < count)) order.push_back(next);
+
+			int previous = (int) slot - (distance * direction);
+			if((distance <= WAV_BANK_PREFETCH_NEIGHBOURS) && (previous >= 0) && (previous < count) && (order.size() <= limit)) order.push_back(previous);
+		}
+
+		return(order);
+	}
+
+	// The average size of the samples that are loaded, or 0 if none have
+	// finished loading yet.  Call with the mutex held.
+	size_t average_memory_used()
+	{
+		size_t total = 0;
+		size_t loaded = 0;
+
+		for(size_t i = 0; i < resident.size(); i++)
+		{
+			size_t bytes = resident[i] ? (*samples)[i].memory_used() : 0;
+			if(bytes > 0)
+			{
+				total += bytes;
+				loaded++;
+			}
+		}
+
+		return((loaded > 0) ? (total / loaded) : 0);
+	}
+
+	// Unloads the least recently selected samples until the ones that are left
+	// fit in the budget.  'keep' is never unloaded.  Call with the mutex held.
+	void evict(unsigned int keep)
+	{
+		if(budget == 0) return;
+		size_t limit = (size_t) budget * 1024 * 1024;
+
+		size_t total = 0;
+		for(size_t i = 0; i < resident.size(); i++)
+		{
+			if(resident[i]) total += (*samples)[i].memory_used();
+		}
+
+		while(total > limit)
+		{
+			size_t oldest = resident.size();
+
+			for(size_t i = 0; i < resident.size(); i++)
+			{
+				if(resident[i] && (i != keep) && ((oldest == resident.size()) || (last_used[i] < last_used[oldest]))) oldest = i;
+			}
+
+			if(oldest == resident.size()) break;
+
+			total -= std::min(total, (*samples)[oldest].memory_used());
+			resident[oldest] = false;
+			(*samples)[oldest].unload();
+		}
+	}
+};
@@ -14,13 +14,8 @@ struct WavBankReadout : TransparentWidget
 	{
 		if(module)
 		{
-			text_to_display = "";
-
-			if(module->samples.size() > module->selected_sample_slot)
-			{
-				text_to_display = module->samples[module->selected_sample_slot].filename;
-				text_to_display.resize(30); // truncate long text
-			}
+			text_to_display = module->selected_filename();
+			if(! text_to_display.empty()) text_to_display.resize(30); // truncate long text
 		}
 
 		// Set font information
@@ -41,6 +41,38 @@ struct WavBankWidget : ModuleWidget
 		menu_item_load_bank->text = "Select Directory Containing WAV Files";
 		menu_item_load_bank->wav_bank_module = module;
 		menu->addChild(menu_item_load_bank);
+
+		// Add the "Load Sample Bank File" menu item
+		MenuItemLoadBankFile *menu_item_load_bank_file = new MenuItemLoadBankFile();
+		menu_item_load_bank_file->text = "Load Sample Bank File (." SAMPLE_BANK_EXTENSION ")";
+		menu_item_load_bank_file->wav_bank_module = module;
+		menu->addChild(menu_item_load_bank_file);
+
+		// Memory budget options
+
+		struct MemoryBudgetMenuItem : MenuItem {
+			WavBank* module;
+			unsigned int megabytes;
+			void onAction(const event::Action& e) override {
+				module->set_memory_budget(megabytes);
+			}
+		};
+
+		menu->addChild(new MenuEntry); // For spacing only
+		menu->addChild(createMenuLabel("Memory budget"));
+
+		const unsigned int budgets[] = { 256, 512, 1024, 2048, 4096, 0 };
+
+		for(unsigned int megabytes : budgets)
+		{
+			std::string name = (megabytes == 0) ? "Unlimited" : (megabytes < 1024) ? (std::to_string(megabytes) + " MB") : (std::to_string(megabytes / 1024) + " GB");
+			MemoryBudgetMenuItem* memory_budget_menu_item = createMenuItem<MemoryBudgetMenuItem>(name, CHECKMARK(module->cache->budget == megabytes));
+			memory_budget_menu_item->module = module;
+			memory_budget_menu_item->megabytes = megabytes;
+			menu->addChild(memory_budget_menu_item);
+		}
+
+		append_sample_encoding_menu(menu, module);
 	}
 
 };
@@ -7,6 +7,7 @@
 #include "plugin.hpp"
 #include "osdialog.h"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
 #include "Common/submodules.hpp"
 #include <fstream>
 
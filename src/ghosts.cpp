@@ -5,6 +5,8 @@
 #include "plugin.hpp"
 #include "osdialog.h"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
+#include "Common/waveform_display.hpp"
 
 #include "Ghosts/defines.h"
 #include "Ghosts/GhostsEx.hpp"
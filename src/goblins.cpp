@@ -6,6 +6,8 @@
 #include "plugin.hpp"
 #include "osdialog.h"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
+#include "Common/waveform_display.hpp"
 
 #include "Goblins/defines.h"
 #include "Goblins/Goblin.hpp"
@@ -7,6 +7,9 @@
 #include "plugin.hpp"
 #include "osdialog.h"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
+#include "Common/sample_region_menu.hpp"
+#include "Common/waveform_display.hpp"
 #include "Common/submodules.hpp"
 
 #include "Repeater/defines.h"
@@ -7,8 +7,11 @@
 #include "plugin.hpp"
 #include "osdialog.h"
 #include "Common/sample.hpp"
+#include "Common/sample_encoding_menu.hpp"
+#include "Common/submodules.hpp"
 
 #include "WavBank/defines.h"
+#include "WavBank/WavBankCache.hpp"
 #include "WavBank/WavBank.hpp"
 #include "WavBank/WavBankReadout.hpp"
 #include "WavBank/MenuItemLoadBank.hpp"
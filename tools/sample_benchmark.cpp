@@ -0,0 +1,148 @@
+//
+// sample_benchmark times how sample files are read, so that changes to the
+// loading code can be measured against what was there before.
+//
+//   sample_benchmark <file> [<file> ...]
+//
+// Each file is loaded with AudioFile several times, and the average speed is
+// reported in megabytes per second.  The first load is left out, so that the
+// numbers are for a file that's already in the operating system's cache
+// rather than for the disk.
+//
+// The audio is then stored in a SampleAudioBuffer in each of the encodings in
+// sample_encoding.hpp, and read back a block at a time the way SampleCursor
+// reads it, to show how much memory each one saves and what it costs to read.
+//
+// It's built on its own, outside of the plugin:
+//
+//   c++ -std=c++11 -O2 -Isrc tools/sample_benchmark.cpp -o sample_benchmark
+//
+
+#include "Common/AudioFile.h"
+#include "Common/sample_audio_buffer.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+// How many times each file is loaded or read, not counting the first
+#define SAMPLE_BENCHMARK_RUNS 5
+
+// The same as SAMPLE_CURSOR_BLOCK_FRAMES in sample.hpp
+#define SAMPLE_BENCHMARK_BLOCK_FRAMES 32
+
+// Time how long it takes to read every frame of 'buffer' a block at a time.
+// Returns nanoseconds per frame.
+static double measure_read_cost(const SampleAudioBuffer &buffer)
+{
+  float scratch[SAMPLE_BENCHMARK_BLOCK_FRAMES * 2];
+  float total = 0.0;
+
+  auto start_time = std::chrono::steady_clock::now();
+
+  for(unsigned int index = 0; index < buffer.size(); index += SAMPLE_BENCHMARK_BLOCK_FRAMES)
+  {
+    unsigned int count = SAMPLE_BENCHMARK_BLOCK_FRAMES;
+    const float *block = buffer.read_block(index, count, scratch);
+    for(unsigned int i = 0; i < count * buffer.channels; i++) total += block[i];
+  }
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time;
+
+  // Keeps the compiler from optimizing the reads away
+  volatile float sink = total;
+  (void) sink;
+
+  return((buffer.size() > 0) ? (elapsed.count() / buffer.size()) : 0.0);
+}
+
+// Store the audio in 'audio_file' in 'buffer', the way the loader does
+static bool store_audio(AudioFile<float> &audio_file, SampleAudioBuffer &buffer)
+{
+  unsigned int frames = (unsigned int) audio_file.getNumSamplesPerChannel();
+  if((frames == 0) || (! buffer.resize(frames))) return(false);
+
+  if(buffer.channels == 1)
+  {
+    buffer.store(0, audio_file.samples[0].data(), frames);
+    return(true);
+  }
+
+  std::vector<float> interleaved((size_t) frames * 2);
+
+  for(unsigned int i = 0; i < frames; i++)
+  {
+    interleaved[(2 * (size_t) i)] = audio_file.samples[0][i];
+    interleaved[(2 * (size_t) i) + 1] = audio_file.samples[1][i];
+  }
+
+  buffer.store(0, interleaved.data(), interleaved.size());
+  return(true);
+}
+
+static void report_read_cost(AudioFile<float> &audio_file)
+{
+  for(unsigned int encoding = 0; encoding < NUMBER_OF_SAMPLE_ENCODINGS; encoding++)
+  {
+    SampleAudioBuffer buffer;
+    buffer.reset(audio_file.getNumChannels(), (SampleEncoding) encoding);
+
+    if(! store_audio(audio_file, buffer))
+    {
+      std::fprintf(stderr, "sample_benchmark: not enough memory\n");
+      return;
+    }
+
+    double total = 0.0;
+    measure_read_cost(buffer);
+
+    for(int run = 0; run < SAMPLE_BENCHMARK_RUNS; run++)
+    {
+      total += measure_read_cost(buffer);
+    }
+
+    std::printf("  %s: %zu bytes, %.3f ns per frame\n", sample_encoding_name(encoding), buffer.memory_size(), total / SAMPLE_BENCHMARK_RUNS);
+  }
+}
+
+static void report(const std::string &path)
+{
+  AudioFile<float> audio_file;
+  audio_file.shouldLogErrorsToConsole(false);
+
+  if(! audio_file.load(path))
+  {
+    std::fprintf(stderr, "sample_benchmark: can't load %s\n", path.c_str());
+    return;
+  }
+
+  double total = 0.0;
+
+  for(int run = 0; run < SAMPLE_BENCHMARK_RUNS; run++)
+  {
+    audio_file.load(path);
+    total += audio_file.getLoadThroughput();
+  }
+
+  std::printf("%s: %d channels, %d frames at %u Hz\n", path.c_str(), audio_file.getNumChannels(), audio_file.getNumSamplesPerChannel(), audio_file.getSampleRate());
+  std::printf("  AudioFile::load(): %.1f MB/s\n", total / SAMPLE_BENCHMARK_RUNS);
+
+  report_read_cost(audio_file);
+}
+
+int main(int argc, char **argv)
+{
+  if(argc < 2)
+  {
+    std::fprintf(stderr, "usage: sample_benchmark <file> [<file> ...]\n");
+    return(1);
+  }
+
+  for(int i = 1; i < argc; i++)
+  {
+    report(argv[i]);
+  }
+
+  return(0);
+}
@@ -0,0 +1,226 @@
+//
+// vgbank_builder packs a folder of .wav files into a sample bank (.vgbank)
+// that Wav Bank can open in one go.  See src/Common/sample_bank_format.hpp
+// for the layout.
+//
+//   vgbank_builder [--int16 | --float16] <folder> <bank.vgbank>
+//
+// Samples are stored as 32-bit floats unless --int16 or --float16 is given,
+// which halves the size of the bank.  Files with more than two channels only
+// keep their first two.  Entries are sorted by filename.  Files that can't be
+// read are skipped, with a warning.
+//
+// It's built on its own, outside of the plugin:
+//
+//   c++ -std=c++11 -O2 -Isrc tools/vgbank_builder.cpp -o vgbank_builder
+//
+
+#define DR_WAV_IMPLEMENTATION
+#include "Common/dr_wav.h"
+#include "Common/sample_encoding.hpp"
+#include "Common/sample_bank_format.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <dirent.h>
+
+static std::vector<std::string> list_wav_files(const std::string &folder)
+{
+  std::vector<std::string> filenames;
+
+  DIR *directory = opendir(folder.c_str());
+  if(directory == NULL) return(filenames);
+
+  while(struct dirent *entry = readdir(directory))
+  {
+    std::string filename = entry->d_name;
+    if(filename.size() < 4) continue;
+
+    std::string extension = filename.substr(filename.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char character) { return((char) std::tolower(character)); });
+
+    if(extension == ".wav") filenames.push_back(filename);
+  }
+
+  closedir(directory);
+  std::sort(filenames.begin(), filenames.end());
+  return(filenames);
+}
+
+// Pads the file out with zeros to the next multiple of SAMPLE_BANK_ALIGNMENT
+static bool align(FILE *file, uint64_t &offset)
+{
+  static const uint8_t zeros[SAMPLE_BANK_ALIGNMENT] = { 0 };
+  size_t padding = (size_t) ((SAMPLE_BANK_ALIGNMENT - (offset % SAMPLE_BANK_ALIGNMENT)) % SAMPLE_BANK_ALIGNMENT);
+
+  offset += padding;
+  return(std::fwrite(zeros, 1, padding, file) == padding);
+}
+
+// Appends one file's audio to the bank, and fills in its entry.  Returns
+// false if the file can't be decoded.
+static bool write_audio(FILE *file, uint64_t &offset, const std::string &path, SampleEncoding encoding, SampleBankEntry &entry)
+{
+  unsigned int channels = 0;
+  unsigned int sample_rate = 0;
+  drwav_uint64 total_samples = 0;
+
+  float *audio = drwav_open_and_read_file_f32(path.c_str(), &channels, &sample_rate, &total_samples);
+  if(audio == NULL) return(false);
+
+  uint64_t frame_count = (channels > 0) ? (total_samples / channels) : 0;
+  unsigned int stored_channels = (channels == 1) ? 1 : 2;
+
+  if((frame_count == 0) || (frame_count > 0xFFFFFFFFull))
+  {
+    drwav_free(audio);
+    return(false);
+  }
+
+  // Anything with more than two channels only keeps its first two
+  if(channels > 2)
+  {
+    for(uint64_t i = 0; i < frame_count; i++)
+    {
+      audio[(2 * i)] = audio[i * channels];
+      audio[(2 * i) + 1] = audio[(i * channels) + 1];
+    }
+  }
+
+  size_t count = (size_t) frame_count * stored_channels;
+  size_t bytes = count * sample_encoding_size(encoding);
+  bool written = false;
+
+  switch(encoding)
+  {
+    case SAMPLE_ENCODING_INT16:
+    {
+      std::vector<int16_t> encoded(count);
+      encode_int16(audio, encoded.data(), count);
+      written = (std::fwrite(encoded.data(), 1, bytes, file) == bytes);
+      break;
+    }
+    case SAMPLE_ENCODING_FLOAT16:
+    {
+      std::vector<HalfFloat> encoded(count);
+      encode_float16(audio, encoded.data(), count);
+      written = (std::fwrite(encoded.data(), 1, bytes, file) == bytes);
+      break;
+    }
+    default:
+      written = (std::fwrite(audio, 1, bytes, file) == bytes);
+  }
+
+  drwav_free(audio);
+  if(! written) return(false);
+
+  entry.channels = stored_channels;
+  entry.encoding = encoding;
+  entry.sample_rate = sample_rate;
+  entry.frame_count = frame_count;
+  entry.offset = offset;
+
+  offset += bytes;
+  return(true);
+}
+
+int main(int argc, char **argv)
+{
+  SampleEncoding encoding = SAMPLE_ENCODING_FLOAT32;
+  std::vector<std::string> arguments;
+
+  for(int i = 1; i < argc; i++)
+  {
+    std::string argument = argv[i];
+
+    if(argument == "--int16") encoding = SAMPLE_ENCODING_INT16;
+    else if(argument == "--float16") encoding = SAMPLE_ENCODING_FLOAT16;
+    else arguments.push_back(argument);
+  }
+
+  if(arguments.size() != 2)
+  {
+    std::fprintf(stderr, "usage: vgbank_builder [--int16 | --float16] <folder> <bank.%s>\n", SAMPLE_BANK_EXTENSION);
+    return(1);
+  }
+
+  std::string folder = arguments[0];
+  std::string bank_path = arguments[1];
+  std::vector<std::string> filenames = list_wav_files(folder);
+
+  if(filenames.empty())
+  {
+    std::fprintf(stderr, "vgbank_builder: no .wav files in %s\n", folder.c_str());
+    return(1);
+  }
+
+  // The bank is written under a temporary name and then renamed, so that a
+  // half-written bank is never left where Wav Bank might open it
+  std::string partial_path = bank_path + ".partial";
+  FILE *file = std::fopen(partial_path.c_str(), "wb");
+
+  if(file == NULL)
+  {
+    std::fprintf(stderr, "vgbank_builder: can't write %s\n", partial_path.c_str());
+    return(1);
+  }
+
+  // The directory goes right after the header.  It's written once the audio
+  // is in place and every entry's offset is known.
+  SampleBankHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "VGBANK\0\0", sizeof(header.magic));
+  header.version = SAMPLE_BANK_VERSION;
+  header.directory_offset = sizeof(header);
+
+  std::vector<SampleBankEntry> entries;
+  uint64_t offset = sizeof(header) + (filenames.size() * sizeof(SampleBankEntry));
+  bool written = (std::fseek(file, (long) offset, SEEK_SET) == 0);
+
+  for(size_t i = 0; written && (i < filenames.size()); i++)
+  {
+    SampleBankEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+
+    // Names are cut short on a character boundary
+    size_t length = std::min(filenames[i].size(), (size_t) SAMPLE_BANK_NAME_LENGTH - 1);
+    while((length > 0) && (length < filenames[i].size()) && ((filenames[i][length] & 0xC0) == 0x80)) length--;
+    std::memcpy(entry.name, filenames[i].data(), length);
+
+    written = align(file, offset);
+
+    if(written && write_audio(file, offset, folder + "/" + filenames[i], encoding, entry))
+    {
+      entries.push_back(entry);
+    }
+    else if(written)
+    {
+      std::fprintf(stderr, "vgbank_builder: skipping %s\n", filenames[i].c_str());
+    }
+  }
+
+  header.entry_count = (uint32_t) entries.size();
+
+  written = written &&
+    (std::fseek(file, 0, SEEK_SET) == 0) &&
+    (std::fwrite(&header, sizeof(header), 1, file) == 1) &&
+    (entries.empty() || (std::fwrite(entries.data(), sizeof(SampleBankEntry), entries.size(), file) == entries.size()));
+
+  written = (std::fclose(file) == 0) && written;
+
+  std::remove(bank_path.c_str());
+
+  if((! written) || (std::rename(partial_path.c_str(), bank_path.c_str()) != 0))
+  {
+    std::fprintf(stderr, "vgbank_builder: can't write %s\n", bank_path.c_str());
+    std::remove(partial_path.c_str());
+    return(1);
+  }
+
+  std::printf("%s: %zu samples, %llu bytes\n", bank_path.c_str(), entries.size(), (unsigned long long) offset);
+  return(0);
+}
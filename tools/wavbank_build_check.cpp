@@ -0,0 +1,268 @@
+//
+// wavbank_build_check makes sure that building a Wav Bank bank never copies
+// or moves a Sample, and never allocates audio.  It builds a bank from a
+// folder of .wav files with WavBankCache::read_folder(), and another from a
+// sample bank file with WavBankCache::read_bank_file(), the same way that
+// the module does on its loader thread, and hands each to a WavBankCache.
+//
+//   wavbank_build_check [number of samples]
+//
+// Every Sample takes a new revision when it's constructed, moved ones
+// included, so the revisions that a bank used up count how many Samples went
+// into building it.  There has to be exactly one for each entry.  Vector
+// growth would show up there too, but it's also checked on its own, along
+// with each Sample still holding the shared empty buffer and nothing else.
+// It prints what it found, and exits with 1 if any of that doesn't hold.
+//
+// It's built against the Rack SDK headers, outside of the plugin.  The few
+// Rack functions that a bank is built with are defined below, so it doesn't
+// need Rack itself to run:
+//
+//   RACK_SDK=<path to the Rack SDK>
+//   c++ -std=c++11 -O2 -I$RACK_SDK/include -I$RACK_SDK/dep/include -Isrc tools/wavbank_build_check.cpp -lpthread -o wavbank_build_check
+//
+
+#define DR_WAV_IMPLEMENTATION
+#include <rack.hpp>
+#include "Common/sample.hpp"
+#include "WavBank/WavBankCache.hpp"
+
+#include <string>
+#include <list>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WAVBANK_BUILD_CHECK_SAMPLES 64
+
+namespace rack {
+
+namespace system {
+
+std::list<std::string> getEntries(const std::string &path)
+{
+  std::list<std::string> entries;
+
+  DIR *directory = opendir(path.c_str());
+  if(directory == NULL) return(entries);
+
+  while(struct dirent *entry = readdir(directory))
+  {
+    std::string filename = entry->d_name;
+    if((filename != ".") && (filename != "..")) entries.push_back(path + "/" + filename);
+  }
+
+  closedir(directory);
+  return(entries);
+}
+
+}
+
+namespace string {
+
+std::string filename(const std::string &path)
+{
+  size_t slash = path.find_last_of('/');
+  return((slash == std::string::npos) ? path : path.substr(slash + 1));
+}
+
+std::string filenameExtension(const std::string &path)
+{
+  std::string name = filename(path);
+  size_t dot = name.find_last_of('.');
+  return((dot == std::string::npos) ? "" : name.substr(dot + 1));
+}
+
+std::string lowercase(const std::string &text)
+{
+  std::string lowered = text;
+  for(char &character : lowered) character = (char) std::tolower((unsigned char) character);
+  return(lowered);
+}
+
+}
+
+}
+
+static bool failed = false;
+
+static void check(bool condition, const char *what)
+{
+  if(condition) return;
+
+  std::fprintf(stderr, "wavbank_build_check: %s\n", what);
+  failed = true;
+}
+
+// A short, silent 16-bit mono .wav.  Nothing is decoded while a bank is
+// built, but the files are real anyway.
+static bool write_wav(const std::string &path)
+{
+  static const int16_t silence[64] = { 0 };
+  uint32_t data_size = sizeof(silence);
+  uint32_t riff_size = 36 + data_size;
+  uint32_t format_size = 16;
+  uint16_t format = 1;
+  uint16_t channels = 1;
+  uint32_t sample_rate = 44100;
+  uint32_t byte_rate = sample_rate * sizeof(int16_t);
+  uint16_t block_align = sizeof(int16_t);
+  uint16_t bits = 16;
+
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if(file == NULL) return(false);
+
+  std::fwrite("RIFF", 1, 4, file);
+  std::fwrite(&riff_size, sizeof(riff_size), 1, file);
+  std::fwrite("WAVEfmt ", 1, 8, file);
+  std::fwrite(&format_size, sizeof(format_size), 1, file);
+  std::fwrite(&format, sizeof(format), 1, file);
+  std::fwrite(&channels, sizeof(channels), 1, file);
+  std::fwrite(&sample_rate, sizeof(sample_rate), 1, file);
+  std::fwrite(&byte_rate, sizeof(byte_rate), 1, file);
+  std::fwrite(&block_align, sizeof(block_align), 1, file);
+  std::fwrite(&bits, sizeof(bits), 1, file);
+  std::fwrite("data", 1, 4, file);
+  std::fwrite(&data_size, sizeof(data_size), 1, file);
+  bool written = (std::fwrite(silence, 1, sizeof(silence), file) == sizeof(silence));
+
+  return((std::fclose(file) == 0) && written);
+}
+
+// A sample bank with 'count' entries of 64 silent float frames each, laid out
+// the way tools/vgbank_builder writes them
+static bool write_bank(const std::string &path, unsigned int count)
+{
+  static const float silence[64] = { 0 };
+
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if(file == NULL) return(false);
+
+  SampleBankHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "VGBANK\0\0", sizeof(header.magic));
+  header.version = SAMPLE_BANK_VERSION;
+  header.entry_count = count;
+  header.directory_offset = sizeof(header);
+
+  // The directory is a multiple of SAMPLE_BANK_ALIGNMENT bytes long, and so
+  // is each entry's audio, so everything after it lines up without padding
+  uint64_t offset = sizeof(header) + ((uint64_t) count * sizeof(SampleBankEntry));
+  bool written = (std::fwrite(&header, sizeof(header), 1, file) == 1);
+
+  for(unsigned int i = 0; written && (i < count); i++)
+  {
+    SampleBankEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    std::snprintf(entry.name, sizeof(entry.name), "entry %03u.wav", i);
+    entry.channels = 1;
+    entry.encoding = SAMPLE_ENCODING_FLOAT32;
+    entry.sample_rate = 44100;
+    entry.frame_count = 64;
+    entry.offset = offset + ((uint64_t) i * sizeof(silence));
+
+    written = (std::fwrite(&entry, sizeof(entry), 1, file) == 1);
+  }
+
+  for(unsigned int i = 0; written && (i < count); i++)
+  {
+    written = (std::fwrite(silence, sizeof(silence), 1, file) == 1);
+  }
+
+  return((std::fclose(file) == 0) && written);
+}
+
+// Builds a bank with 'read', and checks that it has 'expected' entries and
+// that none of its Samples was copied, moved or given any audio
+template <typename Read>
+static void check_bank(const char *name, unsigned int expected, Read read)
+{
+  unsigned int before = next_sample_revision();
+  WavBankSamplesHandle samples = read();
+  unsigned int after = next_sample_revision();
+
+  if(! samples)
+  {
+    check(false, "a bank couldn't be read");
+    return;
+  }
+
+  // Handing the bank to a cache sets every Sample up in place too
+  WavBankCache cache;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.publish(samples);
+  }
+  unsigned int published = next_sample_revision();
+
+  // 'after' took a revision of its own, which doesn't count
+  unsigned int constructed = after - before - 1;
+  bool empty = true;
+
+  for(const Sample &sample : *samples)
+  {
+    if((sample.sample_audio_buffer != empty_sample_audio_buffer()) || (sample.handle != nullptr) || (sample.swap->generation != 0)) empty = false;
+  }
+
+  std::printf("%s: %u entries, %u Samples constructed, capacity %u\n", name, (unsigned int) samples->size(), constructed, (unsigned int) samples->capacity());
+
+  check(samples->size() == expected, "the bank is missing entries");
+  check(constructed == expected, "Samples were moved or copied while the bank was built");
+  check(published - after == 1, "Samples were constructed while the bank was published");
+  check(samples->capacity() == samples->size(), "the bank grew while it was built");
+  check(empty, "audio was allocated while the bank was built");
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int count = (argc > 1) ? (unsigned int) std::atoi(argv[1]) : WAVBANK_BUILD_CHECK_SAMPLES;
+
+  if(count == 0)
+  {
+    std::fprintf(stderr, "usage: wavbank_build_check [number of samples]\n");
+    return(1);
+  }
+
+  char directory[] = "/tmp/wavbank_build_check.XXXXXX";
+
+  if(mkdtemp(directory) == NULL)
+  {
+    std::fprintf(stderr, "wavbank_build_check: can't make a temporary folder\n");
+    return(1);
+  }
+
+  std::string folder = std::string(directory) + "/folder";
+  std::string bank_path = std::string(directory) + "/bank." SAMPLE_BANK_EXTENSION;
+  bool written = (mkdir(folder.c_str(), 0755) == 0) && write_bank(bank_path, count);
+
+  for(unsigned int i = 0; written && (i < count); i++)
+  {
+    char filename[32];
+    std::snprintf(filename, sizeof(filename), "/sample %03u.wav", i);
+    written = write_wav(folder + filename);
+  }
+
+  // Something that isn't a .wav, which the folder's bank leaves out
+  if(written) written = write_bank(folder + "/skipped.txt", 1);
+
+  if(written)
+  {
+    check_bank("folder", count, [&]() { return(WavBankCache::read_folder(folder)); });
+    check_bank("bank file", count, [&]() { return(WavBankCache::read_bank_file(bank_path)); });
+  }
+  else
+  {
+    std::fprintf(stderr, "wavbank_build_check: can't write the test files in %s\n", directory);
+    failed = true;
+  }
+
+  std::string remove = std::string("rm -rf '") + directory + "'";
+  if(std::system(remove.c_str()) != 0) std::fprintf(stderr, "wavbank_build_check: couldn't remove %s\n", directory);
+
+  if(! failed) std::printf("ok\n");
+  return(failed ? 1 : 0);
+}